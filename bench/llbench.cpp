@@ -0,0 +1,366 @@
+
+// Latency and throughput of the logging paths, one JSON object per line
+// (or CSV with --csv) for every case and thread count:
+//   llbench [--threads N] [--iters K] [--cases a,b,...] [--dir D] [--csv]
+// Threads run 1, 2, 4, ... up to N calls at once. Every thread makes K
+// untimed calls to measure throughput, then K individually timed calls
+// for the latency percentiles, from which the cost of reading the clock
+// is subtracted.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async.hpp"
+#include "binLog.hpp"
+#include "blockSink.hpp"
+#include "fileSink.hpp"
+#include "llogger.h"
+#include "mmapRing.hpp"
+#include "nativeSyslog.hpp"
+#include "syslog.hpp"
+#include "uringSink.hpp"
+
+namespace{
+
+using clk = std::chrono::steady_clock;
+
+struct result{
+    std::string name;
+    unsigned threads;
+    size_t iters;
+    double nsPerCall;
+    double callsPerSec;
+    double mbPerSec;
+    double p50;
+    double p99;
+    double p999;
+};
+
+struct options{
+    unsigned threads = std::max(1U, std::thread::hardware_concurrency());
+    size_t iters = 200000;
+    std::vector<std::string> cases;
+    std::string dir = "/tmp";
+    bool csv = false;
+};
+
+// Read at runtime so that predicates are not folded away
+bool never = false;
+
+long long nsSince(clk::time_point start){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clk::now() - start).count();
+}
+
+unsigned long long fileSize(const std::string& path){
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<unsigned long long>(st.st_size) : 0;
+}
+
+// Median cost of one clock read, subtracted from timed calls
+double timerOverhead(){
+    std::vector<long long> samples(10000);
+    for(long long& s: samples){
+        const clk::time_point start = clk::now();
+        s = nsSince(start);
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return static_cast<double>(samples[samples.size() / 2]);
+}
+
+// Start body(t) on every thread at once, returns the wall time in ns
+template<typename Body>
+long long runThreads(unsigned threads, Body&& body){
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> pool;
+    for(unsigned t = 0; t < threads; ++t){
+        pool.emplace_back([&, t]{
+            ready.fetch_add(1);
+            while(!go.load()){
+                std::this_thread::yield();
+            }
+            body(t);
+        });
+    }
+    while(ready.load() != threads){
+        std::this_thread::yield();
+    }
+    const clk::time_point start = clk::now();
+    go.store(true);
+    for(std::thread& th: pool){
+        th.join();
+    }
+    return nsSince(start);
+}
+
+double percentile(std::vector<float>& samples, double p){
+    if(samples.empty()){
+        return 0;
+    }
+    const size_t idx = std::min(samples.size() - 1, static_cast<size_t>(p * static_cast<double>(samples.size())));
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(idx), samples.end());
+    return samples[idx];
+}
+
+// bytes returns how much the case has written so far, if it writes a file
+template<typename Call>
+result measure(const std::string& name, unsigned threads, size_t iters, double overhead,
+               Call&& call, const std::function<unsigned long long()>& bytes = nullptr){
+    result ret;
+    ret.name = name;
+    ret.threads = threads;
+    ret.iters = iters;
+
+    const unsigned long long bytes0 = bytes ? bytes() : 0;
+    const long long wall = runThreads(threads, [&](unsigned){
+        for(size_t i = 0; i < iters; ++i){
+            call(i);
+        }
+    });
+    const unsigned long long written = bytes ? bytes() - bytes0 : 0;
+
+    const double calls = static_cast<double>(iters) * threads;
+    ret.callsPerSec = calls * 1e9 / static_cast<double>(wall);
+    ret.nsPerCall = static_cast<double>(wall) * threads / calls;
+    ret.mbPerSec = static_cast<double>(written) / 1e6 * 1e9 / static_cast<double>(wall);
+
+    std::vector<std::vector<float> > lats(threads, std::vector<float>(iters));
+    runThreads(threads, [&](unsigned t){
+        std::vector<float>& lat = lats[t];
+        for(size_t i = 0; i < iters; ++i){
+            const clk::time_point start = clk::now();
+            call(i);
+            lat[i] = static_cast<float>(std::max(0.0, static_cast<double>(nsSince(start)) - overhead));
+        }
+    });
+
+    std::vector<float> all;
+    all.reserve(iters * threads);
+    for(const std::vector<float>& lat: lats){
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    ret.p50 = percentile(all, 0.5);
+    ret.p99 = percentile(all, 0.99);
+    ret.p999 = percentile(all, 0.999);
+    return ret;
+}
+
+template<typename L>
+inline void logLine(L& lg, size_t i){
+    lg(ll::info) << "request " << i << " took " << 1.5 << " ms";
+}
+
+void print(const result& r, bool csv){
+    if(csv){
+        std::printf("%s,%u,%zu,%.2f,%.0f,%.2f,%.1f,%.1f,%.1f\n", r.name.c_str(), r.threads, r.iters,
+                    r.nsPerCall, r.callsPerSec, r.mbPerSec, r.p50, r.p99, r.p999);
+    }else{
+        std::printf("{\"case\":\"%s\",\"threads\":%u,\"iters\":%zu,\"ns_per_call\":%.2f,"
+                    "\"calls_per_s\":%.0f,\"mb_per_s\":%.2f,\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f}\n",
+                    r.name.c_str(), r.threads, r.iters, r.nsPerCall, r.callsPerSec, r.mbPerSec,
+                    r.p50, r.p99, r.p999);
+    }
+    std::fflush(stdout);
+}
+
+result runCase(const std::string& name, unsigned threads, const options& opt, double overhead){
+    const size_t n = opt.iters;
+    const std::string path = opt.dir + "/llbench." + name;
+    ::unlink(path.c_str());
+    auto size = [&path]{
+        return fileSize(path);
+    };
+
+    if(name == "disabled_level"){
+        ll::OStreamSync sync(std::cout);
+        ll::llogger<> lg(ll::error, sync);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        });
+    }
+    if(name == "disabled_predicate"){
+        ll::OStreamSync sync(std::cout);
+        ll::llogger<> lg(ll::debug, sync);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            lg(ll::info, never) << "request " << i << " took " << 1.5 << " ms";
+        });
+    }
+    if(name == "lazy_disabled" || name == "lazy_enabled"){
+        std::ofstream null("/dev/null");
+        ll::OStreamSync sync(null);
+        ll::llogger<> lg(name == "lazy_enabled" ? ll::debug : ll::error, sync);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            lg(ll::info) << "request " << [i]{
+                return std::to_string(i);
+            };
+        });
+    }
+    if(name == "devnull"){
+        std::ofstream null("/dev/null");
+        ll::OStreamSync sync(null);
+        ll::llogger<> lg(ll::debug, sync);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        });
+    }
+    if(name == "file"){
+        ll::FileSink sink(path);
+        ll::llogger<ll::FileSink> lg(ll::debug, sink);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        }, size);
+    }
+    if(name == "ofstream"){
+        std::ofstream file(path);
+        ll::OStreamSync sync(file, ll::flushPolicy(1 << 16));
+        ll::llogger<> lg(ll::debug, sync);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        }, [&]{
+            sync.flush();
+            return fileSize(path);
+        });
+    }
+    if(name == "uring"){
+        ll::UringSink sink(path, ll::flushPolicy(1 << 16));
+        ll::llogger<ll::UringSink> lg(ll::debug, sink);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        }, [&]{
+            sink.flush();
+            return fileSize(path);
+        });
+    }
+    if(name == "async"){
+        ll::FileSink sink(path);
+        ll::AsyncBackend<ll::FileSink> async(sink);
+        ll::llogger<ll::AsyncBackend<ll::FileSink> > lg(ll::debug, async);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        }, [&]{
+            async.flush();
+            return fileSize(path);
+        });
+    }
+    if(name == "ring"){
+        ll::MmapRing ring(path);
+        ll::llogger<ll::MmapRing> lg(ll::debug, ring);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        });
+    }
+    if(name == "binlog"){
+        ll::BinLog blog(path);
+        static const ll::bfmt<size_t, double> took("request {} took {} ms");
+        return measure(name, threads, n, overhead, [&blog](size_t i){
+            blog(ll::info, took, i, 1.5);
+        }, [&]{
+            blog.flush();
+            return fileSize(path);
+        });
+    }
+    if(name == "block"){
+        ll::BlockSink sink(path);
+        ll::llogger<ll::BlockSink> lg(ll::debug, sink);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        }, [&]{
+            sink.flush();
+            return fileSize(path);
+        });
+    }
+    if(name == "syslog"){
+        ll::Syslog sys("llbench");
+        ll::llogger<ll::Syslog> lg(ll::debug, sys);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        });
+    }
+    if(name == "native_syslog"){
+        ll::NativeSyslog sys("llbench", LOG_USER, ll::rfc3164, ll::flushPolicy(1 << 16));
+        ll::llogger<ll::NativeSyslog> lg(ll::debug, sys);
+        return measure(name, threads, n, overhead, [&lg](size_t i){
+            logLine(lg, i);
+        });
+    }
+
+    std::fprintf(stderr, "unknown case %s\n", name.c_str());
+    std::exit(2);
+}
+
+std::vector<std::string> split(const char* list){
+    std::vector<std::string> ret;
+    const char* begin = list;
+    for(const char* p = list; ; ++p){
+        if(*p == ',' || *p == '\0'){
+            if(p != begin){
+                ret.emplace_back(begin, p);
+            }
+            if(*p == '\0'){
+                break;
+            }
+            begin = p + 1;
+        }
+    }
+    return ret;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    options opt;
+    for(int i = 1; i < argc; ++i){
+        const bool hasValue = i + 1 < argc;
+        if(std::strcmp(argv[i], "--threads") == 0 && hasValue){
+            opt.threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        }else if(std::strcmp(argv[i], "--iters") == 0 && hasValue){
+            opt.iters = static_cast<size_t>(std::max(1LL, std::atoll(argv[++i])));
+        }else if(std::strcmp(argv[i], "--cases") == 0 && hasValue){
+            opt.cases = split(argv[++i]);
+        }else if(std::strcmp(argv[i], "--dir") == 0 && hasValue){
+            opt.dir = argv[++i];
+        }else if(std::strcmp(argv[i], "--csv") == 0){
+            opt.csv = true;
+        }else{
+            std::fprintf(stderr, "usage: %s [--threads N] [--iters K] [--cases a,b,...] [--dir D] [--csv]\n"
+                                 "cases: disabled_level disabled_predicate lazy_disabled lazy_enabled devnull\n"
+                                 "       file ofstream uring async ring binlog block syslog native_syslog (not run by default)\n", argv[0]);
+            return 2;
+        }
+    }
+    if(opt.cases.empty()){
+        opt.cases = split("disabled_level,disabled_predicate,lazy_disabled,lazy_enabled,"
+                          "devnull,file,ofstream,uring,async,ring,binlog,block");
+    }
+
+    std::vector<unsigned> counts;
+    for(unsigned t = 1; t < opt.threads; t *= 2){
+        counts.push_back(t);
+    }
+    counts.push_back(opt.threads);
+
+    const double overhead = timerOverhead();
+    if(opt.csv){
+        std::printf("case,threads,iters,ns_per_call,calls_per_s,mb_per_s,p50_ns,p99_ns,p999_ns\n");
+    }
+    for(const std::string& name: opt.cases){
+        for(unsigned threads: counts){
+            print(runCase(name, threads, opt, overhead), opt.csv);
+        }
+        ::unlink((opt.dir + "/llbench." + name).c_str());
+        ::unlink((opt.dir + "/llbench." + name + ".idx").c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,287 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "lldefs.h"
+#include "metrics.hpp"
+
+namespace ll{
+
+// Backend wrapper handing finished lines to a bounded lock-free ring,
+// which is drained to the wrapped backend on a dedicated thread
+template<typename B>
+class AsyncBackend{
+  public:
+    enum overflow: char{block, drop, overwrite};
+
+    inline AsyncBackend(B& backend, size_t capacity = 8192, overflow policy = block);
+    AsyncBackend(const AsyncBackend&) = delete;
+    inline ~AsyncBackend();
+
+    inline void log(const std::string& str, level lev);
+    // Block until every line logged before the call reached the backend
+    inline void flush();
+    inline unsigned long long dropped() const;
+
+  private:
+    struct alignas(64) slot{
+        std::atomic<size_t> seq;
+        level lev;
+        std::string str;
+    };
+
+    // Frees the slots, which new[] does not align to 64 bytes before C++17
+    struct slotsDeleter{
+        size_t count;
+        void* storage;
+
+        inline void operator() (slot* slots) const;
+    };
+
+    B& backend_;
+    const size_t mask_;
+    const overflow policy_;
+    std::unique_ptr<slot[], slotsDeleter> slots_;
+
+    alignas(64) std::atomic<size_t> enqPos_;
+    alignas(64) std::atomic<size_t> deqPos_;
+    alignas(64) std::atomic<size_t> done_;
+    std::atomic<unsigned long long> dropped_;
+    std::atomic<bool> sleeping_;
+    std::atomic<bool> stop_;
+    // Deepest backlog the worker saw
+    detail::queueGauge depth_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    inline bool push(const std::string& str, level lev);
+    template<typename F>
+    inline bool pop(F&& consume);
+    inline void wake();
+    inline void run();
+    inline void countDropped();
+
+    inline static size_t roundCapacity(size_t capacity);
+    inline static std::unique_ptr<slot[], slotsDeleter> makeSlots(size_t count);
+};
+
+template<typename B>
+AsyncBackend<B>::AsyncBackend(B& backend, size_t capacity, overflow policy):
+                              backend_(backend),
+                              mask_(roundCapacity(capacity) - 1),
+                              policy_(policy),
+                              slots_(makeSlots(mask_ + 1)),
+                              enqPos_(0),
+                              deqPos_(0),
+                              done_(0),
+                              dropped_(0),
+                              sleeping_(false),
+                              stop_(false),
+                              depth_("async", mask_ + 1){
+    for(size_t i = 0; i <= mask_; ++i){
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    worker_ = std::thread(&AsyncBackend<B>::run, this);
+}
+
+template<typename B>
+AsyncBackend<B>::~AsyncBackend(){
+    stop_.store(true);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        cv_.notify_one();
+    }
+    worker_.join();
+}
+
+template<typename B>
+void AsyncBackend<B>::log(const std::string& str, level lev){
+    if(push(str, lev)){
+        wake();
+        return;
+    }
+    depth_.update(mask_ + 1);
+
+    switch(policy_){
+        case drop:
+            countDropped();
+            return;
+        case overwrite:
+            while(!push(str, lev)){
+                if(pop([](slot&){})){
+                    done_.fetch_add(1, std::memory_order_release);
+                    countDropped();
+                }
+            }
+            break;
+        default:
+            while(!push(str, lev)){
+                wake();
+                std::this_thread::yield();
+            }
+    }
+    wake();
+}
+
+template<typename B>
+void AsyncBackend<B>::flush(){
+    const size_t target = enqPos_.load();
+    while(done_.load(std::memory_order_acquire) < target){
+        wake();
+        std::this_thread::yield();
+    }
+}
+
+template<typename B>
+unsigned long long AsyncBackend<B>::dropped() const{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+template<typename B>
+bool AsyncBackend<B>::push(const std::string& str, level lev){
+    size_t pos = enqPos_.load(std::memory_order_relaxed);
+    slot* cell;
+    for(;;){
+        cell = &slots_[pos & mask_];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(dif == 0){
+            if(enqPos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                break;
+            }
+        }else if(dif < 0){
+            return false;
+        }else{
+            pos = enqPos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Reuses the capacity left in the slot by earlier lines
+    cell->str.assign(str);
+    cell->lev = lev;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename B>
+template<typename F>
+bool AsyncBackend<B>::pop(F&& consume){
+    size_t pos = deqPos_.load(std::memory_order_relaxed);
+    slot* cell;
+    for(;;){
+        cell = &slots_[pos & mask_];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if(dif == 0){
+            if(deqPos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                break;
+            }
+        }else if(dif < 0){
+            return false;
+        }else{
+            pos = deqPos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    consume(*cell);
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename B>
+void AsyncBackend<B>::wake(){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping_.load(std::memory_order_relaxed)){
+        std::lock_guard<std::mutex> lk(mtx_);
+        cv_.notify_one();
+    }
+}
+
+template<typename B>
+void AsyncBackend<B>::run(){
+    auto consume = [this](slot& cell){
+        depth_.update(enqPos_.load(std::memory_order_relaxed) - deqPos_.load(std::memory_order_relaxed) + 1);
+        detail::backendLog(backend_, cell.str, cell.lev);
+    };
+
+    for(;;){
+        bool popped = false;
+        for(int spin = 0; spin < 256; ++spin){
+            if(pop(consume)){
+                done_.fetch_add(1, std::memory_order_release);
+                popped = true;
+                break;
+            }
+        }
+        if(popped){
+            continue;
+        }
+
+        if(stop_.load()){
+            // A producer may have taken a slot and not filled it yet
+            if(deqPos_.load() == enqPos_.load()){
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(mtx_);
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(deqPos_.load() == enqPos_.load() && !stop_.load()){
+            cv_.wait_for(lk, std::chrono::milliseconds(100));
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
+
+template<typename B>
+void AsyncBackend<B>::countDropped(){
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    if(metricsEnabled){
+        detail::threadMetrics::local().dropped.add(1);
+    }
+}
+
+template<typename B>
+size_t AsyncBackend<B>::roundCapacity(size_t capacity){
+    size_t ret = 2;
+    while(ret < capacity){
+        ret <<= 1;
+    }
+    return ret;
+}
+
+template<typename B>
+std::unique_ptr<typename AsyncBackend<B>::slot[], typename AsyncBackend<B>::slotsDeleter>
+AsyncBackend<B>::makeSlots(size_t count){
+    void* storage = ::operator new(count * sizeof(slot) + alignof(slot));
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(storage);
+    slot* slots = reinterpret_cast<slot*>((addr + alignof(slot) - 1) & ~static_cast<uintptr_t>(alignof(slot) - 1));
+    for(size_t i = 0; i < count; ++i){
+        new(slots + i) slot();
+    }
+    return std::unique_ptr<slot[], slotsDeleter>(slots, slotsDeleter{count, storage});
+}
+
+template<typename B>
+void AsyncBackend<B>::slotsDeleter::operator() (slot* slots) const{
+    for(size_t i = 0; i < count; ++i){
+        slots[i].~slot();
+    }
+    ::operator delete(storage);
+}
+
+}
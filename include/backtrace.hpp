@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "lldefs.h"
+#include "uidMap.hpp"
+
+namespace ll{
+
+namespace detail{
+
+// Last lines of a llogger on one thread that were below its enabled level,
+// kept until an error on the thread writes them. Slots keep their
+// capacity, so that capturing allocates nothing once the ring went round.
+class backtraceRing{
+  public:
+    // Overwrite the oldest line once lines are kept
+    inline void push(const char* data, size_t len, level lev, size_t lines);
+    // Pass the lines to f(const std::string&, level), oldest first, and
+    // empty the ring
+    template<typename Fn>
+    inline void drain(Fn&& f);
+
+    // Ring of the llogger with the given uid on the calling thread, dropped
+    // some time after the llogger is destroyed
+    inline static backtraceRing& of(unsigned long long uid);
+
+  private:
+    struct entry{
+        std::string line;
+        level lev;
+    };
+
+    std::vector<entry> entries_;
+    size_t next_ = 0;
+    size_t count_ = 0;
+    // Set while draining, when lines logged by the backend are not kept
+    bool busy_ = false;
+};
+
+void backtraceRing::push(const char* data, size_t len, level lev, size_t lines){
+    if(busy_ || lines == 0){
+        return;
+    }
+    if(entries_.size() != lines){
+        entries_.resize(lines);
+        next_ %= lines;
+        count_ = count_ < lines ? count_ : lines;
+    }
+
+    entry& e = entries_[next_];
+    e.line.assign(data, len);
+    e.lev = lev;
+    next_ = next_ + 1 == lines ? 0 : next_ + 1;
+    if(count_ < lines){
+        ++count_;
+    }
+}
+
+template<typename Fn>
+void backtraceRing::drain(Fn&& f){
+    if(busy_ || count_ == 0){
+        return;
+    }
+    struct busyGuard{
+        backtraceRing& ring;
+        ~busyGuard(){
+            ring.busy_ = false;
+            ring.count_ = 0;
+        }
+    } guard{*this};
+    busy_ = true;
+
+    const size_t size = entries_.size();
+    for(size_t i = next_ + size - count_; count_ != 0; ++i, --count_){
+        const entry& e = entries_[i % size];
+        f(e.line, e.lev);
+    }
+}
+
+backtraceRing& backtraceRing::of(unsigned long long uid){
+    static thread_local unsigned long long lastUid = 0;
+    static thread_local backtraceRing* last = nullptr;
+
+    if(lastUid != uid){
+        static thread_local uidMap<backtraceRing> all;
+        last = &all.get(uid);
+        lastUid = uid;
+    }
+    return *last;
+}
+
+} // namespace detail
+
+}
@@ -0,0 +1,739 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fastFmt.hpp"
+#include "fileIo.hpp"
+#include "lldefs.h"
+#include "timestamp.hpp"
+
+namespace ll{
+
+namespace detail{
+
+// Entries of a binary log, after an 8 byte magic, all start with
+//   u32 id, u32 size of the whole entry
+// Id 0 registers a format:  u32 format id, u32 text size, text, type codes
+// Other ids are statements: i64 ns since epoch, u8 level, arguments
+struct binFile{
+    static constexpr char magic[8] = {'L', 'L', 'B', 'I', 'N', '\0', '\0', '\1'};
+    static constexpr size_t entryHead = 8;
+    static constexpr size_t recordHead = entryHead + 9;
+};
+
+constexpr char binFile::magic[8];
+
+inline void putU32(char* out, uint32_t value){
+    std::memcpy(out, &value, 4);
+}
+
+inline uint32_t getU32(const char* in){
+    uint32_t ret;
+    std::memcpy(&ret, in, 4);
+    return ret;
+}
+
+// How an argument of type T is recorded: a type code, then 8 bytes for
+// numbers and pointers, 1 for bool and the char types, or u32 size and
+// the bytes for strings
+template<typename T, typename = void>
+struct binArg;
+
+template<typename T>
+struct binFixed{
+    static constexpr size_t size(const T&){
+        return sizeof(T);
+    }
+    static char* put(char* out, const T& value){
+        std::memcpy(out, &value, sizeof(T));
+        return out + sizeof(T);
+    }
+};
+
+template<>
+struct binArg<bool>: binFixed<bool>{
+    static constexpr char code = 'b';
+};
+
+template<>
+struct binArg<char>: binFixed<char>{
+    static constexpr char code = 'c';
+};
+
+// int8_t and uint8_t, decoded as numbers
+template<>
+struct binArg<signed char>: binFixed<signed char>{
+    static constexpr char code = 'h';
+};
+
+template<>
+struct binArg<unsigned char>: binFixed<unsigned char>{
+    static constexpr char code = 'H';
+};
+
+template<typename T>
+struct binArg<T, typename std::enable_if<isFastInt<T>::value>::type>{
+    static constexpr char code = std::is_signed<T>::value ? 'i' : 'u';
+    using wide = typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type;
+
+    static constexpr size_t size(T){
+        return 8;
+    }
+    static char* put(char* out, T value){
+        const wide w = static_cast<wide>(value);
+        std::memcpy(out, &w, 8);
+        return out + 8;
+    }
+};
+
+template<typename T>
+struct binArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>{
+    static constexpr char code = 'd';
+
+    static constexpr size_t size(T){
+        return 8;
+    }
+    static char* put(char* out, T value){
+        const double d = static_cast<double>(value);
+        std::memcpy(out, &d, 8);
+        return out + 8;
+    }
+};
+
+template<typename P>
+struct binArg<P*, typename std::enable_if<!isCharLike<typename std::remove_cv<P>::type>::value>::type>{
+    static constexpr char code = 'p';
+
+    static constexpr size_t size(const P*){
+        return 8;
+    }
+    static char* put(char* out, const P* ptr){
+        const uint64_t u = reinterpret_cast<uintptr_t>(ptr);
+        std::memcpy(out, &u, 8);
+        return out + 8;
+    }
+};
+
+struct binStr{
+    static constexpr char code = 's';
+
+    static char* putStr(char* out, const char* str, size_t len){
+        putU32(out, static_cast<uint32_t>(len));
+        std::memcpy(out + 4, str, len);
+        return out + 4 + len;
+    }
+};
+
+template<>
+struct binArg<const char*>: binStr{
+    static size_t size(const char* str){
+        return 4 + (str == nullptr ? 0 : std::strlen(str));
+    }
+    static char* put(char* out, const char* str){
+        return putStr(out, str, size(str) - 4);
+    }
+};
+
+template<>
+struct binArg<std::string>: binStr{
+    static size_t size(const std::string& str){
+        return 4 + str.size();
+    }
+    static char* put(char* out, const std::string& str){
+        return putStr(out, str.data(), str.size());
+    }
+};
+
+#ifdef LL_HAS_CHARCONV
+template<>
+struct binArg<std::string_view>: binStr{
+    static size_t size(std::string_view str){
+        return 4 + str.size();
+    }
+    static char* put(char* out, std::string_view str){
+        return putStr(out, str.data(), str.size());
+    }
+};
+#endif
+
+template<typename T>
+struct typeOf{
+    using type = T;
+};
+
+inline size_t sumSizes(){
+    return 0;
+}
+
+template<typename A, typename... As>
+inline size_t sumSizes(const A& arg, const As&... args){
+    return binArg<A>::size(arg) + sumSizes(args...);
+}
+
+inline char* putArgs(char* out){
+    return out;
+}
+
+template<typename A, typename... As>
+inline char* putArgs(char* out, const A& arg, const As&... args){
+    return putArgs(binArg<A>::put(out, arg), args...);
+}
+
+// Formats registered by every bfmt, shared by all binary logs
+class binRegistry{
+  public:
+    struct entry{
+        std::string text;
+        std::string types;
+    };
+
+    inline static binRegistry& get();
+
+    inline uint32_t add(const char* text, std::string types);
+    // Entries from the given id on
+    inline std::vector<std::pair<uint32_t, entry> > since(uint32_t id);
+
+  private:
+    std::mutex mtx_;
+    std::vector<entry> entries_;
+};
+
+binRegistry& binRegistry::get(){
+    static binRegistry ret;
+    return ret;
+}
+
+uint32_t binRegistry::add(const char* text, std::string types){
+    std::lock_guard<std::mutex> lk(mtx_);
+    entries_.push_back({text, std::move(types)});
+    return static_cast<uint32_t>(entries_.size());
+}
+
+std::vector<std::pair<uint32_t, binRegistry::entry> > binRegistry::since(uint32_t id){
+    std::lock_guard<std::mutex> lk(mtx_);
+    std::vector<std::pair<uint32_t, entry> > ret;
+    for(uint32_t i = id; i <= entries_.size(); ++i){
+        ret.emplace_back(i, entries_[i - 1]);
+    }
+    return ret;
+}
+
+// Single producer, single consumer byte ring written by one logging thread.
+// Entries are 8 byte aligned and never wrap: an entry with id 0 pads the
+// end of the ring when the next one does not fit.
+struct binBuffer{
+    explicit binBuffer(size_t capacity): data(new char[capacity]),
+                                         capacity(capacity),
+                                         head(0),
+                                         cachedTail(0),
+                                         tail(0),
+                                         retired(false){
+    }
+
+    std::unique_ptr<char[]> data;
+    const size_t capacity;
+
+    alignas(64) std::atomic<size_t> head;
+    size_t cachedTail;
+    alignas(64) std::atomic<size_t> tail;
+    std::atomic<bool> retired;
+};
+
+inline unsigned long long binTicks(){
+#ifdef LL_HAS_TSC
+    return tscClock::ticks();
+#else
+    return static_cast<unsigned long long>(realtimeNs());
+#endif
+}
+
+inline long long binTicksToNs(unsigned long long ticks){
+#ifdef LL_HAS_TSC
+    return tscClock::toNs(ticks);
+#else
+    return static_cast<long long>(ticks);
+#endif
+}
+
+} // namespace detail
+
+// Format of a binary log statement: text with a {} placeholder for each
+// argument, and the argument types. Declare it static, so that it is
+// registered once:
+//   static const ll::bfmt<int, double> took("request {} took {} ms");
+//   blog(ll::info, took, id, ms);
+template<typename... Args>
+class bfmt{
+  public:
+    inline explicit bfmt(const char* text);
+
+    inline uint32_t id() const;
+
+  private:
+    uint32_t id_;
+};
+
+template<typename... Args>
+bfmt<Args...>::bfmt(const char* text){
+    static_assert(sizeof...(Args) < 256, "too many arguments");
+    const char codes[] = {detail::binArg<Args>::code..., '\0'};
+    id_ = detail::binRegistry::get().add(text, std::string(codes, sizeof...(Args)));
+}
+
+template<typename... Args>
+uint32_t bfmt<Args...>::id() const{
+    return id_;
+}
+
+// Binary logger deferring all formatting: a statement copies the id of its
+// bfmt, the time stamp counter and its raw arguments into a buffer owned
+// by the calling thread. A background thread moves the buffers to a file,
+// which lldecode or BinDecoder turn into text.
+class BinLog{
+  public:
+    inline BinLog(const std::string& path,
+                  level lev = debug,
+                  size_t threadBuffer = 1 << 20,
+                  std::chrono::microseconds poll = std::chrono::milliseconds(1));
+    BinLog(const BinLog&) = delete;
+    inline ~BinLog();
+
+    template<typename... Args>
+    inline void operator() (level lev, const bfmt<Args...>& fmt,
+                            const typename detail::typeOf<Args>::type&... args);
+
+    // Block until every statement logged before the call is written
+    inline void flush();
+    inline unsigned long long errors() const;
+
+  private:
+    const unsigned long long uid_;
+    const level level_;
+    const size_t bufCap_;
+    const std::chrono::microseconds poll_;
+    int fd_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable passCv_;
+    std::vector<std::shared_ptr<detail::binBuffer> > buffers_;
+    unsigned long long passes_;
+    bool stop_;
+    std::atomic<unsigned long long> errors_;
+    std::thread writer_;
+
+    uint32_t fmtsWritten_;
+    std::string out_;
+
+    inline detail::binBuffer& localBuffer();
+    inline char* reserve(detail::binBuffer& buf, size_t size);
+    inline void run();
+    inline bool drain(detail::binBuffer& buf);
+    inline void writeFormats();
+    inline void writeOut();
+
+    inline static unsigned long long nextUid();
+};
+
+BinLog::BinLog(const std::string& path, level lev, size_t threadBuffer, std::chrono::microseconds poll):
+               uid_(nextUid()),
+               level_(lev),
+               bufCap_((threadBuffer + 7) & ~static_cast<size_t>(7)),
+               poll_(poll),
+               fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+               passes_(0),
+               stop_(false),
+               errors_(0),
+               fmtsWritten_(1){
+    // Calibrate the counter now rather than on the first statement
+    detail::binTicksToNs(detail::binTicks());
+    if(fd_ < 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    out_.append(detail::binFile::magic, sizeof(detail::binFile::magic));
+    writer_ = std::thread(&BinLog::run, this);
+}
+
+BinLog::~BinLog(){
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+template<typename... Args>
+void BinLog::operator() (level lev, const bfmt<Args...>& fmt,
+                         const typename detail::typeOf<Args>::type&... args){
+    if(lev > level_){
+        return;
+    }
+
+    const unsigned long long ticks = detail::binTicks();
+    const size_t size = (detail::binFile::recordHead + detail::sumSizes(args...) + 7) &
+                        ~static_cast<size_t>(7);
+    detail::binBuffer& buf = localBuffer();
+    char* rec = reserve(buf, size);
+    if(rec == nullptr){
+        return;
+    }
+
+    detail::putU32(rec, fmt.id());
+    detail::putU32(rec + 4, static_cast<uint32_t>(size));
+    std::memcpy(rec + 8, &ticks, 8);
+    rec[16] = static_cast<char>(lev);
+    detail::putArgs(rec + detail::binFile::recordHead, args...);
+    buf.head.store(buf.head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+void BinLog::flush(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    // The pass running now may have missed the last statements
+    const unsigned long long target = passes_ + 2;
+    cv_.notify_one();
+    passCv_.wait(lk, [this, target]{
+        return passes_ >= target || stop_;
+    });
+}
+
+unsigned long long BinLog::errors() const{
+    return errors_.load(std::memory_order_relaxed);
+}
+
+detail::binBuffer& BinLog::localBuffer(){
+    struct threadBuffers{
+        unsigned long long lastUid = 0;
+        detail::binBuffer* last = nullptr;
+        std::vector<std::pair<unsigned long long, std::shared_ptr<detail::binBuffer> > > all;
+
+        ~threadBuffers(){
+            for(auto& buf: all){
+                buf.second->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
+    static thread_local threadBuffers bufs;
+
+    if(bufs.lastUid == uid_){
+        return *bufs.last;
+    }
+    for(auto& buf: bufs.all){
+        if(buf.first == uid_){
+            bufs.lastUid = uid_;
+            bufs.last = buf.second.get();
+            return *bufs.last;
+        }
+    }
+
+    std::shared_ptr<detail::binBuffer> buf = std::make_shared<detail::binBuffer>(bufCap_);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        buffers_.push_back(buf);
+    }
+    bufs.all.emplace_back(uid_, buf);
+    bufs.lastUid = uid_;
+    bufs.last = buf.get();
+    return *bufs.last;
+}
+
+char* BinLog::reserve(detail::binBuffer& buf, size_t size){
+    if(size > buf.capacity){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    size_t head = buf.head.load(std::memory_order_relaxed);
+    const size_t off = head % buf.capacity;
+    const size_t pad = off + size > buf.capacity ? buf.capacity - off : 0;
+    while(head + pad + size - buf.cachedTail > buf.capacity){
+        buf.cachedTail = buf.tail.load(std::memory_order_acquire);
+        if(head + pad + size - buf.cachedTail > buf.capacity){
+            cv_.notify_one();
+            std::this_thread::yield();
+        }
+    }
+
+    if(pad > 0){
+        detail::putU32(buf.data.get() + off, 0);
+        detail::putU32(buf.data.get() + off + 4, static_cast<uint32_t>(pad));
+        head += pad;
+        buf.head.store(head, std::memory_order_release);
+    }
+    return buf.data.get() + head % buf.capacity;
+}
+
+void BinLog::run(){
+    std::vector<std::shared_ptr<detail::binBuffer> > buffers;
+    std::unique_lock<std::mutex> lk(mtx_);
+    for(;;){
+        const bool stop = stop_;
+        buffers = buffers_;
+        lk.unlock();
+
+        bool busy = false;
+        for(auto& buf: buffers){
+            busy = drain(*buf) || busy;
+        }
+        writeOut();
+
+        lk.lock();
+        // Buffers of exited threads are dropped once read to the end
+        for(size_t i = 0; i < buffers_.size();){
+            detail::binBuffer& buf = *buffers_[i];
+            if(buf.retired.load(std::memory_order_acquire) &&
+               buf.head.load(std::memory_order_acquire) == buf.tail.load(std::memory_order_relaxed)){
+                buffers_[i] = buffers_.back();
+                buffers_.pop_back();
+            }else{
+                ++i;
+            }
+        }
+        ++passes_;
+        passCv_.notify_all();
+        if(stop){
+            break;
+        }
+        if(!busy && !stop_){
+            cv_.wait_for(lk, poll_);
+        }
+    }
+}
+
+bool BinLog::drain(detail::binBuffer& buf){
+    const size_t head = buf.head.load(std::memory_order_acquire);
+    size_t tail = buf.tail.load(std::memory_order_relaxed);
+    if(head == tail){
+        return false;
+    }
+
+    // Formats are registered before the statements using them are logged
+    writeFormats();
+    while(tail != head){
+        const char* rec = buf.data.get() + tail % buf.capacity;
+        const uint32_t size = detail::getU32(rec + 4);
+        if(detail::getU32(rec) != 0){
+            const size_t at = out_.size();
+            out_.append(rec, size);
+            unsigned long long ticks;
+            std::memcpy(&ticks, rec + 8, 8);
+            const long long ns = detail::binTicksToNs(ticks);
+            std::memcpy(&out_[at + 8], &ns, 8);
+        }
+        tail += size;
+        if(out_.size() >= (1 << 16)){
+            buf.tail.store(tail, std::memory_order_release);
+            writeOut();
+        }
+    }
+    buf.tail.store(tail, std::memory_order_release);
+    return true;
+}
+
+void BinLog::writeFormats(){
+    for(auto& fmt: detail::binRegistry::get().since(fmtsWritten_)){
+        const size_t size = detail::binFile::entryHead + 8 + fmt.second.text.size() + fmt.second.types.size();
+        char head[16];
+        detail::putU32(head, 0);
+        detail::putU32(head + 4, static_cast<uint32_t>(size));
+        detail::putU32(head + 8, fmt.first);
+        detail::putU32(head + 12, static_cast<uint32_t>(fmt.second.text.size()));
+        out_.append(head, sizeof(head));
+        out_.append(fmt.second.text);
+        out_.append(fmt.second.types);
+        fmtsWritten_ = fmt.first + 1;
+    }
+}
+
+void BinLog::writeOut(){
+    if(fd_ >= 0 && !out_.empty() && !detail::writeAll(fd_, out_.data(), out_.size())){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    out_.clear();
+}
+
+unsigned long long BinLog::nextUid(){
+    static std::atomic<unsigned long long> uid(0);
+    return ++uid;
+}
+
+// Reads a file written by BinLog and renders its statements as text
+class BinDecoder{
+  public:
+    inline explicit BinDecoder(const std::string& path);
+
+    inline bool good() const;
+    // Call f(level, ns since epoch, text) for every statement in file order.
+    // Returns false if the file is truncated or corrupt.
+    template<typename F>
+    inline bool forEach(F&& f);
+
+  private:
+    std::vector<char> data_;
+    std::vector<detail::binRegistry::entry> fmts_;
+    bool good_;
+
+    inline bool render(const detail::binRegistry::entry& fmt, const char* args, const char* end,
+                       detail::msgBuf& out) const;
+};
+
+BinDecoder::BinDecoder(const std::string& path): good_(false){
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return;
+    }
+    char chunk[1 << 16];
+    ssize_t len;
+    while((len = read(fd, chunk, sizeof(chunk))) > 0){
+        data_.insert(data_.end(), chunk, chunk + len);
+    }
+    close(fd);
+
+    good_ = len == 0 && data_.size() >= sizeof(detail::binFile::magic) &&
+            std::memcmp(data_.data(), detail::binFile::magic, sizeof(detail::binFile::magic)) == 0;
+}
+
+bool BinDecoder::good() const{
+    return good_;
+}
+
+template<typename F>
+bool BinDecoder::forEach(F&& f){
+    if(!good_){
+        return false;
+    }
+
+    detail::msgBuf text;
+    std::string line;
+    size_t pos = sizeof(detail::binFile::magic);
+    while(pos + detail::binFile::entryHead <= data_.size()){
+        const char* entry = data_.data() + pos;
+        const uint32_t id = detail::getU32(entry);
+        const uint32_t size = detail::getU32(entry + 4);
+        if(size < detail::binFile::entryHead || pos + size > data_.size()){
+            return false;
+        }
+        pos += size;
+
+        if(id == 0){
+            if(size < detail::binFile::entryHead + 8){
+                return false;
+            }
+            const uint32_t fmtId = detail::getU32(entry + 8);
+            const uint32_t textLen = detail::getU32(entry + 12);
+            if(fmtId == 0 || 16 + static_cast<size_t>(textLen) > size){
+                return false;
+            }
+            if(fmts_.size() < fmtId){
+                fmts_.resize(fmtId);
+            }
+            fmts_[fmtId - 1].text.assign(entry + 16, textLen);
+            fmts_[fmtId - 1].types.assign(entry + 16 + textLen, size - 16 - textLen);
+            continue;
+        }
+
+        if(id > fmts_.size() || size < detail::binFile::recordHead){
+            return false;
+        }
+        long long ns;
+        std::memcpy(&ns, entry + 8, 8);
+        const level lev = static_cast<level>(entry[16]);
+        text.clear();
+        if(!render(fmts_[id - 1], entry + detail::binFile::recordHead, entry + size, text)){
+            return false;
+        }
+        line.assign(text.data(), text.size());
+        f(lev, ns, line);
+    }
+    return pos == data_.size();
+}
+
+bool BinDecoder::render(const detail::binRegistry::entry& fmt, const char* args, const char* end,
+                        detail::msgBuf& out) const{
+    detail::fmtSpec spec;
+    const std::string& str = fmt.text;
+    size_t from = 0;
+    for(char code: fmt.types){
+        const size_t mark = str.find("{}", from);
+        const size_t upto = mark == std::string::npos ? str.size() : mark;
+        out.append(str.data() + from, upto - from);
+        from = mark == std::string::npos ? str.size() : mark + 2;
+
+        const size_t fixed = code == 'b' || code == 'c' || code == 'h' || code == 'H' ? 1 : code == 's' ? 4 : 8;
+        if(static_cast<size_t>(end - args) < fixed){
+            return false;
+        }
+        switch(code){
+            case 'b':
+                detail::fmtValue(out, *args != 0, spec);
+                break;
+            case 'c':
+                detail::fmtValue(out, *args, spec);
+                break;
+            case 'h':
+                detail::fmtValue(out, static_cast<int>(static_cast<signed char>(*args)), spec);
+                break;
+            case 'H':
+                detail::fmtValue(out, static_cast<unsigned>(static_cast<unsigned char>(*args)), spec);
+                break;
+            case 'i':{
+                int64_t v;
+                std::memcpy(&v, args, 8);
+                detail::fmtValue(out, static_cast<long long>(v), spec);
+                break;
+            }
+            case 'u':{
+                uint64_t v;
+                std::memcpy(&v, args, 8);
+                detail::fmtValue(out, static_cast<unsigned long long>(v), spec);
+                break;
+            }
+            case 'd':{
+                double v;
+                std::memcpy(&v, args, 8);
+                detail::fmtValue(out, v, spec);
+                break;
+            }
+            case 'p':{
+                uint64_t v;
+                std::memcpy(&v, args, 8);
+                detail::fmtValue(out, reinterpret_cast<const void*>(static_cast<uintptr_t>(v)), spec);
+                break;
+            }
+            case 's':{
+                const uint32_t len = detail::getU32(args);
+                if(static_cast<size_t>(end - args) < 4 + static_cast<size_t>(len)){
+                    return false;
+                }
+                out.append(args + 4, len);
+                args += len;
+                break;
+            }
+            default:
+                return false;
+        }
+        args += fixed;
+    }
+    out.append(str.data() + from, str.size() - from);
+    return true;
+}
+
+}
@@ -0,0 +1,544 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LL_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "fileIo.hpp"
+#include "lldefs.h"
+#include "lz.hpp"
+#include "metrics.hpp"
+#include "osSync.hpp"
+#include "timestamp.hpp"
+
+namespace ll{
+
+enum blockCodec: char{
+    storeBlocks, // No compression
+    lzBlocks,    // Built-in LZ77 codec, fast on both ends
+    zlibBlocks   // Deflate at its fastest level, requires LL_WITH_ZLIB
+};
+
+// Entry of the sidecar index, one per block of the data file
+struct blockInfo{
+    // Wall clock time the first line entered the block and the block was
+    // sealed, in ns since epoch
+    int64_t firstNs;
+    int64_t lastNs;
+    // Where the block frame starts in the data file
+    uint64_t offset;
+    uint32_t compLen;
+    uint32_t rawLen;
+};
+
+static_assert(sizeof(blockInfo) == 32, "index entries must stay 32 bytes");
+
+namespace detail{
+
+// A data file is a sequence of blockFrame headers, each followed by the
+// compLen bytes of its block. A block holds whole lines ending with '\n'.
+// The index file <path>.idx starts with indexMagic and holds a blockInfo
+// per block; it can be rebuilt from the data file.
+struct blockFrame{
+    static constexpr char magicStr[4] = {'L', 'L', 'B', 'K'};
+    static constexpr char indexMagic[8] = {'L', 'L', 'B', 'I', 'D', 'X', '\0', '\1'};
+    // Bounds a frame header read from a damaged file must respect
+    static constexpr uint32_t maxRawLen = 1U << 30;
+
+    char magic[4];
+    uint8_t codec;
+    uint8_t reserved[3];
+    uint32_t rawLen;
+    uint32_t compLen;
+    // Of the compressed bytes
+    uint32_t hash;
+    uint32_t reserved2;
+    int64_t firstNs;
+    int64_t lastNs;
+};
+
+constexpr char blockFrame::magicStr[4];
+constexpr char blockFrame::indexMagic[8];
+
+static_assert(sizeof(blockFrame) == 40, "block frames must stay 40 bytes");
+
+inline uint32_t blockHash(const char* p, size_t len){
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    for(; len >= 8; p += 8, len -= 8){
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for(; len > 0; ++p, --len){
+        h = (h ^ static_cast<unsigned char>(*p)) * 0x100000001b3ULL;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+// Read the frame at offset and its compressed bytes into payload, and
+// check them against each other
+inline bool readBlockFrame(int fd, uint64_t offset, uint64_t fileSize, blockFrame& frame, std::string& payload){
+    if(fileSize < offset + sizeof(blockFrame) || !preadAll(fd, &frame, sizeof(frame), offset) ||
+       std::memcmp(frame.magic, blockFrame::magicStr, sizeof(frame.magic)) != 0 ||
+       frame.rawLen > blockFrame::maxRawLen || frame.compLen > fileSize - offset - sizeof(blockFrame)){
+        return false;
+    }
+    payload.resize(frame.compLen);
+    return preadAll(fd, &payload[0], frame.compLen, offset + sizeof(blockFrame)) &&
+           blockHash(payload.data(), payload.size()) == frame.hash;
+}
+
+// Blocks of a data file: the entries of its index which point inside the
+// file, then those recovered by scanning the frames written after them.
+// Returns how many came from the index, and sets end to the end of the
+// last valid block.
+inline size_t loadBlockIndex(int fd, int indexFd, std::vector<blockInfo>& blocks, uint64_t& end){
+    blocks.clear();
+    end = 0;
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        return 0;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+
+    char magic[sizeof(blockFrame::indexMagic)];
+    if(indexFd >= 0 && fstat(indexFd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(magic) &&
+       preadAll(indexFd, magic, sizeof(magic), 0) && std::memcmp(magic, blockFrame::indexMagic, sizeof(magic)) == 0){
+        blocks.resize((static_cast<size_t>(st.st_size) - sizeof(magic)) / sizeof(blockInfo));
+        if(!blocks.empty() && !preadAll(indexFd, blocks.data(), blocks.size() * sizeof(blockInfo), sizeof(magic))){
+            blocks.clear();
+        }
+        while(!blocks.empty() && blocks.back().offset + sizeof(blockFrame) + blocks.back().compLen > fileSize){
+            blocks.pop_back();
+        }
+    }
+    const size_t indexed = blocks.size();
+    if(indexed > 0){
+        end = blocks.back().offset + sizeof(blockFrame) + blocks.back().compLen;
+    }
+
+    blockFrame frame;
+    std::string payload;
+    while(readBlockFrame(fd, end, fileSize, frame, payload)){
+        blocks.push_back(blockInfo{frame.firstNs, frame.lastNs, end, frame.compLen, frame.rawLen});
+        end += sizeof(blockFrame) + frame.compLen;
+    }
+    return indexed;
+}
+
+} // namespace detail
+
+// Backend collecting lines into blocks, which a background thread
+// compresses and appends to the data file, recording the time span and
+// offset of each block in a sidecar index. BlockReader then decompresses
+// only the blocks overlapping a time range.
+class BlockSink{
+  public:
+    // The policy gives the uncompressed block size, the longest time a
+    // line waits in an unsealed block, and the level sealing it at once
+    inline BlockSink(const std::string& path,
+                     const flushPolicy& policy = flushPolicy(1 << 20, std::chrono::seconds(1), fatal),
+                     blockCodec codec = lzBlocks);
+    BlockSink(const BlockSink&) = delete;
+    inline ~BlockSink();
+
+    inline void log(const std::string& str, level lev);
+    // Seal the current block and wait until every block is written
+    inline void flush();
+    inline unsigned long long errors() const;
+
+  private:
+    struct block{
+        std::string data;
+        int64_t firstNs = 0;
+        int64_t lastNs = 0;
+    };
+
+    // Sealed blocks waiting for the writer before logging threads block
+    static constexpr size_t maxQueued = 4;
+
+    const std::string path_;
+    const flushPolicy policy_;
+    blockCodec codec_;
+    int fd_;
+    int indexFd_;
+    // End of the data file, only touched by the writer thread
+    uint64_t offset_;
+    std::atomic<unsigned long long> errors_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable doneCv_;
+    block current_;
+    std::chrono::steady_clock::time_point opened_;
+    std::deque<block> sealed_;
+    // Buffers of written blocks, reused by the following ones
+    std::vector<std::string> free_;
+    unsigned long long sealedCount_;
+    unsigned long long writtenCount_;
+    bool stop_;
+    // Deepest the queue of sealed blocks has been
+    detail::queueGauge depth_;
+    std::thread writer_;
+
+    detail::lzCodec lz_;
+    std::string out_;
+
+    inline void recover();
+    inline void seal();
+    inline void run();
+    inline void writeBlock(const block& b);
+};
+
+BlockSink::BlockSink(const std::string& path, const flushPolicy& policy, blockCodec codec): path_(path),
+                                                                                            policy_(policy),
+                                                                                            codec_(codec),
+                                                                                            fd_(-1),
+                                                                                            indexFd_(-1),
+                                                                                            offset_(0),
+                                                                                            errors_(0),
+                                                                                            sealedCount_(0),
+                                                                                            writtenCount_(0),
+                                                                                            stop_(false),
+                                                                                            depth_(path_, maxQueued){
+#ifndef LL_WITH_ZLIB
+    if(codec_ == zlibBlocks){
+        codec_ = lzBlocks;
+    }
+#endif
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    indexFd_ = ::open((path_ + ".idx").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0 || indexFd_ < 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }else{
+        recover();
+    }
+    current_.data.reserve(policy_.bytes);
+    writer_ = std::thread(&BlockSink::run, this);
+}
+
+BlockSink::~BlockSink(){
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        seal();
+        stop_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+
+    if(fd_ >= 0){
+        close(fd_);
+    }
+    if(indexFd_ >= 0){
+        close(indexFd_);
+    }
+}
+
+void BlockSink::log(const std::string& str, level lev){
+    std::unique_lock<std::mutex> lk(mtx_);
+    if(current_.data.empty()){
+        current_.firstNs = detail::realtimeNs();
+        opened_ = std::chrono::steady_clock::now();
+    }
+    current_.data.append(str);
+    current_.data.push_back('\n');
+
+    if(current_.data.size() >= policy_.bytes || lev <= policy_.immediate){
+        // Memory stays bounded when the writer falls behind
+        doneCv_.wait(lk, [this]{
+            return sealed_.size() < maxQueued;
+        });
+        seal();
+        lk.unlock();
+        cv_.notify_one();
+    }
+}
+
+void BlockSink::flush(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    seal();
+    const unsigned long long target = sealedCount_;
+    cv_.notify_one();
+    doneCv_.wait(lk, [this, target]{
+        return writtenCount_ >= target;
+    });
+}
+
+unsigned long long BlockSink::errors() const{
+    return errors_.load(std::memory_order_relaxed);
+}
+
+void BlockSink::recover(){
+    // Index the blocks a crash left unindexed, and drop a torn last block
+    std::vector<blockInfo> blocks;
+    const size_t indexed = detail::loadBlockIndex(fd_, indexFd_, blocks, offset_);
+
+    struct stat st;
+    if(fstat(fd_, &st) == 0 && static_cast<uint64_t>(st.st_size) > offset_ && ftruncate(fd_, static_cast<off_t>(offset_)) != 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Rewrite the index from its last valid entry, or from scratch
+    const size_t magicLen = sizeof(detail::blockFrame::indexMagic);
+    const off_t indexSize = static_cast<off_t>(magicLen + indexed * sizeof(blockInfo));
+    bool ok;
+    if(indexed == 0){
+        iovec iov{const_cast<char*>(detail::blockFrame::indexMagic), magicLen};
+        ok = ftruncate(indexFd_, 0) == 0 && detail::writeAllv(indexFd_, &iov, 1);
+    }else{
+        ok = fstat(indexFd_, &st) == 0 && (st.st_size == indexSize || ftruncate(indexFd_, indexSize) == 0);
+    }
+    if(ok && blocks.size() > indexed){
+        iovec iov{&blocks[indexed], (blocks.size() - indexed) * sizeof(blockInfo)};
+        ok = detail::writeAllv(indexFd_, &iov, 1);
+    }
+    if(!ok){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void BlockSink::seal(){
+    if(current_.data.empty()){
+        return;
+    }
+    current_.lastNs = detail::realtimeNs();
+    sealed_.push_back(std::move(current_));
+    depth_.update(sealed_.size());
+    current_ = block();
+    if(!free_.empty()){
+        current_.data.swap(free_.back());
+        free_.pop_back();
+    }else{
+        current_.data.reserve(policy_.bytes);
+    }
+    ++sealedCount_;
+}
+
+void BlockSink::run(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    for(;;){
+        if(sealed_.empty()){
+            if(stop_){
+                return;
+            }
+            if(policy_.interval.count() <= 0){
+                cv_.wait(lk);
+                continue;
+            }
+
+            // Seal a block that has waited long enough
+            const auto due = opened_ + policy_.interval;
+            if(!current_.data.empty() && std::chrono::steady_clock::now() >= due){
+                seal();
+            }else{
+                cv_.wait_for(lk, current_.data.empty() ? policy_.interval :
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     due - std::chrono::steady_clock::now()) + std::chrono::milliseconds(1));
+            }
+            continue;
+        }
+
+        block b = std::move(sealed_.front());
+        sealed_.pop_front();
+        lk.unlock();
+        writeBlock(b);
+        lk.lock();
+
+        b.data.clear();
+        free_.push_back(std::move(b.data));
+        ++writtenCount_;
+        doneCv_.notify_all();
+    }
+}
+
+void BlockSink::writeBlock(const block& b){
+    detail::blockFrame frame;
+    std::memcpy(frame.magic, detail::blockFrame::magicStr, sizeof(frame.magic));
+    std::memset(frame.reserved, 0, sizeof(frame.reserved));
+    frame.reserved2 = 0;
+    frame.codec = storeBlocks;
+    frame.rawLen = static_cast<uint32_t>(b.data.size());
+    frame.firstNs = b.firstNs;
+    frame.lastNs = b.lastNs;
+
+    const char* payload = b.data.data();
+    size_t len = b.data.size();
+    if(codec_ == lzBlocks){
+        const size_t packed = lz_.compress(b.data.data(), b.data.size(), out_);
+        if(packed != 0){
+            frame.codec = lzBlocks;
+            payload = out_.data();
+            len = packed;
+        }
+    }
+#ifdef LL_WITH_ZLIB
+    if(codec_ == zlibBlocks){
+        uLongf packed = compressBound(static_cast<uLong>(b.data.size()));
+        out_.resize(packed);
+        if(compress2(reinterpret_cast<Bytef*>(&out_[0]), &packed, reinterpret_cast<const Bytef*>(b.data.data()),
+                     static_cast<uLong>(b.data.size()), Z_BEST_SPEED) == Z_OK && packed < b.data.size()){
+            frame.codec = zlibBlocks;
+            payload = out_.data();
+            len = packed;
+        }
+    }
+#endif
+    frame.compLen = static_cast<uint32_t>(len);
+    frame.hash = detail::blockHash(payload, len);
+
+    if(fd_ < 0 || indexFd_ < 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    iovec iov[2];
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = const_cast<char*>(payload);
+    iov[1].iov_len = len;
+    struct stat st;
+    if(!detail::writeAllv(fd_, iov, 2)){
+        // Later blocks follow whatever part of this one was written
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        if(fstat(fd_, &st) == 0){
+            offset_ = static_cast<uint64_t>(st.st_size);
+        }
+        return;
+    }
+
+    blockInfo info{frame.firstNs, frame.lastNs, offset_, frame.compLen, frame.rawLen};
+    iovec entry{&info, sizeof(info)};
+    if(!detail::writeAllv(indexFd_, &entry, 1)){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    offset_ += sizeof(frame) + len;
+}
+
+// Reads the lines of a file written by BlockSink, decompressing only the
+// blocks whose time span overlaps the requested range
+class BlockReader{
+  public:
+    inline explicit BlockReader(const std::string& path);
+    BlockReader(const BlockReader&) = delete;
+    inline ~BlockReader();
+
+    inline bool good() const;
+    inline const std::vector<blockInfo>& blocks() const;
+
+    // Call f(const char* line, size_t len) for each line of the blocks
+    // overlapping [fromNs, toNs], oldest first. Lines carry no time of
+    // their own, so the first and last blocks may hold lines outside the
+    // range. Returns the number of blocks that could not be read.
+    template<typename F>
+    inline size_t forEach(long long fromNs, long long toNs, F&& f);
+    template<typename F>
+    inline size_t forEach(F&& f);
+
+  private:
+    int fd_;
+    uint64_t size_;
+    std::vector<blockInfo> blocks_;
+    std::string payload_;
+    std::string raw_;
+
+    inline bool readBlock(const blockInfo& info);
+};
+
+BlockReader::BlockReader(const std::string& path): fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC)),
+                                                   size_(0){
+    const int indexFd = ::open((path + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+    detail::loadBlockIndex(fd_, indexFd, blocks_, size_);
+    if(indexFd >= 0){
+        close(indexFd);
+    }
+}
+
+BlockReader::~BlockReader(){
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+bool BlockReader::good() const{
+    return fd_ >= 0;
+}
+
+const std::vector<blockInfo>& BlockReader::blocks() const{
+    return blocks_;
+}
+
+template<typename F>
+size_t BlockReader::forEach(long long fromNs, long long toNs, F&& f){
+    size_t failed = 0;
+    for(const blockInfo& info: blocks_){
+        if(info.lastNs < fromNs || info.firstNs > toNs){
+            continue;
+        }
+        if(!readBlock(info)){
+            ++failed;
+            continue;
+        }
+
+        const char* p = raw_.data();
+        const char* end = p + raw_.size();
+        while(p < end){
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            const char* lineEnd = nl == nullptr ? end : nl;
+            f(p, static_cast<size_t>(lineEnd - p));
+            p = lineEnd + 1;
+        }
+    }
+    return failed;
+}
+
+template<typename F>
+size_t BlockReader::forEach(F&& f){
+    return forEach(INT64_MIN, INT64_MAX, std::forward<F>(f));
+}
+
+bool BlockReader::readBlock(const blockInfo& info){
+    detail::blockFrame frame;
+    if(!detail::readBlockFrame(fd_, info.offset, size_, frame, payload_) || frame.compLen != info.compLen){
+        return false;
+    }
+
+    raw_.resize(frame.rawLen);
+    switch(frame.codec){
+        case storeBlocks:
+            raw_.swap(payload_);
+            return raw_.size() == frame.rawLen;
+        case lzBlocks:
+            return detail::lzCodec::decompress(payload_.data(), payload_.size(), &raw_[0], raw_.size());
+#ifdef LL_WITH_ZLIB
+        case zlibBlocks:{
+            uLongf len = static_cast<uLongf>(raw_.size());
+            return uncompress(reinterpret_cast<Bytef*>(&raw_[0]), &len, reinterpret_cast<const Bytef*>(payload_.data()),
+                              static_cast<uLong>(payload_.size())) == Z_OK && len == raw_.size();
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+}
@@ -0,0 +1,318 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "llogger.h"
+#include "tee.hpp"
+
+namespace ll{
+
+namespace detail{
+
+// 64-bit hash of a message, two multiply-xorshift lanes over 16 bytes at
+// a time. Not meant to resist crafted collisions.
+inline uint64_t messageHash(const char* p, size_t len){
+    uint64_t a = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t b = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t w0, w1;
+    for(; len >= 16; p += 16, len -= 16){
+        std::memcpy(&w0, p, 8);
+        std::memcpy(&w1, p + 8, 8);
+        a = (a ^ w0) * 0xff51afd7ed558ccdULL;
+        b = (b ^ w1) * 0xc4ceb9fe1a85ec53ULL;
+        a ^= a >> 32;
+        b ^= b >> 29;
+    }
+    if(len >= 8){
+        std::memcpy(&w0, p, 8);
+        a = (a ^ w0) * 0xff51afd7ed558ccdULL;
+        a ^= a >> 32;
+        p += 8;
+        len -= 8;
+    }
+    w1 = 0;
+    std::memcpy(&w1, p, len);
+    b = (b ^ w1) * 0xc4ceb9fe1a85ec53ULL;
+
+    uint64_t h = a ^ (b << 31 | b >> 33);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 33);
+}
+
+// Line rendered by a Coalesce on this thread, reused by the next ones
+struct coalesceLine{
+    std::string str;
+    bool busy = false;
+
+    inline static coalesceLine& local();
+};
+
+coalesceLine& coalesceLine::local(){
+    static thread_local coalesceLine ret;
+    return ret;
+}
+
+} // namespace detail
+
+// Backend wrapper collapsing identical messages: the first occurrence of
+// a message is written, the repeats that follow it within the window are
+// counted, and one "last message repeated N times: message" line is
+// written once the window closed. Messages are told apart by their text
+// and level, so the llogger renders only the message and the Coalesce
+// renders its format around it, like a Tee.
+//
+// Messages are kept in a fixed table indexed by their hash, where a new
+// message evicts an older one that collides with it, reporting its
+// repeats early. A repeat is counted by a compare-and-swap on a word
+// packing 40 bits of the hash with the count, so two messages would only
+// be merged if their hashes matched on the slot index and those bits as
+// well. Once that fails, messages are compared by their text under the
+// mutex of the slot. A timer thread writes the counts of closed windows
+// every half window, and flush() and the destructor write all of them.
+template<typename B>
+class Coalesce{
+  public:
+    inline Coalesce(B& backend,
+                    std::chrono::milliseconds window = std::chrono::seconds(1),
+                    const llfmt& format = detail::defaultFormat<llfmt>(),
+                    size_t slots = 1024);
+    Coalesce(const Coalesce&) = delete;
+    inline ~Coalesce();
+
+    inline void log(const std::string& str, level lev);
+    // Write the counts of the repeats suppressed so far
+    inline void flush();
+
+  private:
+    // The state of a slot holds the tag of its message in the high bits
+    // and its repeats in the low ones, 0 when free
+    static constexpr unsigned countBits = 24;
+    static constexpr uint64_t maxCount = (1ULL << countBits) - 1;
+
+    struct slot{
+        // Only changed from 0 or to another tag under mtx
+        std::atomic<uint64_t> state{0};
+        std::atomic<long long> startNs{0};
+        std::mutex mtx;
+        level lev = info;
+        sourceLoc loc{"", 0};
+        std::string text;
+    };
+
+    B& backend_;
+    const long long windowNs_;
+    const llfmt& format_;
+    const size_t mask_;
+    std::unique_ptr<slot[]> slots_;
+
+    std::mutex timerMtx_;
+    bool stop_;
+    std::condition_variable cv_;
+    std::thread timer_;
+
+    inline void sweep(long long now, bool all);
+    // Count a repeat if s holds the message with this tag within the
+    // window and its count is not full
+    inline bool addRepeat(slot& s, uint64_t tag, long long now);
+    // Append the repeat count line of s to out and free s. Called with
+    // the mutex of s held.
+    inline void takeRepeats(slot& s, std::string& out, level& lev, sourceLoc& loc);
+    inline void emit(const std::string& msg, level lev, const sourceLoc& loc);
+    inline void runTimer();
+
+    inline static size_t roundSlots(size_t slots);
+};
+
+template<typename B>
+Coalesce<B>::Coalesce(B& backend,
+                      std::chrono::milliseconds window,
+                      const llfmt& format,
+                      size_t slots): backend_(backend),
+                                     windowNs_(static_cast<long long>(window.count()) * 1000000LL),
+                                     format_(format),
+                                     mask_(roundSlots(slots) - 1),
+                                     slots_(new slot[mask_ + 1]),
+                                     stop_(false){
+    if(windowNs_ > 0){
+        timer_ = std::thread(&Coalesce::runTimer, this);
+    }
+}
+
+template<typename B>
+Coalesce<B>::~Coalesce(){
+    if(timer_.joinable()){
+        {
+            std::lock_guard<std::mutex> lk(timerMtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+    }
+    flush();
+}
+
+template<typename B>
+void Coalesce<B>::log(const std::string& str, level lev){
+    const uint64_t hash = detail::messageHash(str.data(), str.size()) ^
+                          static_cast<uint64_t>(static_cast<unsigned char>(lev)) * 0x9e3779b97f4a7c15ULL;
+    // The low bits of the hash pick the slot, the high ones make the tag
+    const uint64_t tag = (hash >> countBits | 1) << countBits;
+    slot& s = slots_[hash & mask_];
+    const long long now = detail::monotonicNs();
+
+    if(addRepeat(s, tag, now)){
+        return;
+    }
+
+    const sourceLoc loc = *detail::dispatchLoc();
+    std::string previous;
+    level previousLev = lev;
+    sourceLoc previousLoc = loc;
+    {
+        std::lock_guard<std::mutex> lk(s.mtx);
+        // Another thread may have taken the slot for the same message
+        if(s.text == str && s.lev == lev && addRepeat(s, tag, now)){
+            return;
+        }
+        // Repeats of the message seen before, or of the one it evicts
+        takeRepeats(s, previous, previousLev, previousLoc);
+
+        s.text.assign(str);
+        s.lev = lev;
+        s.loc = loc;
+        s.startNs.store(now, std::memory_order_relaxed);
+        s.state.store(tag, std::memory_order_release);
+    }
+
+    if(!previous.empty()){
+        emit(previous, previousLev, previousLoc);
+    }
+    emit(str, lev, loc);
+}
+
+template<typename B>
+void Coalesce<B>::flush(){
+    sweep(detail::monotonicNs(), true);
+}
+
+template<typename B>
+bool Coalesce<B>::addRepeat(slot& s, uint64_t tag, long long now){
+    uint64_t state = s.state.load(std::memory_order_acquire);
+    while((state & ~maxCount) == tag && (state & maxCount) != maxCount &&
+          now - s.startNs.load(std::memory_order_relaxed) < windowNs_){
+        if(s.state.compare_exchange_weak(state, state + 1, std::memory_order_relaxed)){
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename B>
+void Coalesce<B>::sweep(long long now, bool all){
+    std::string line;
+    level lev = info;
+    sourceLoc loc{"", 0};
+    auto due = [&](const slot& s){
+        return (s.state.load(std::memory_order_relaxed) & maxCount) != 0 &&
+               (all || now - s.startNs.load(std::memory_order_relaxed) >= windowNs_);
+    };
+    for(size_t i = 0; i <= mask_; ++i){
+        slot& s = slots_[i];
+        if(!due(s)){
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(s.mtx);
+            // Another message may have taken the slot meanwhile
+            if(due(s)){
+                takeRepeats(s, line, lev, loc);
+            }
+        }
+        if(!line.empty()){
+            emit(line, lev, loc);
+            line.clear();
+        }
+    }
+}
+
+template<typename B>
+void Coalesce<B>::takeRepeats(slot& s, std::string& out, level& lev, sourceLoc& loc){
+    // Taking the count and freeing the slot at once, a repeat is either
+    // counted here or finds the slot free
+    const uint64_t repeats = s.state.exchange(0, std::memory_order_relaxed) & maxCount;
+    if(repeats == 0){
+        return;
+    }
+
+    out.append("last message repeated ");
+    out.append(std::to_string(repeats));
+    out.append(repeats == 1 ? " time: " : " times: ");
+    out.append(s.text);
+    lev = s.lev;
+    loc = s.loc;
+}
+
+template<typename B>
+void Coalesce<B>::emit(const std::string& msg, level lev, const sourceLoc& loc){
+    // The backend may itself log through this Coalesce
+    detail::coalesceLine& local = detail::coalesceLine::local();
+    std::string own;
+    std::string& line = local.busy ? own : local.str;
+    const bool owner = !local.busy;
+    local.busy = true;
+
+    detail::teeClocks clocks;
+    detail::teeRender(format_, lev, loc, clocks, line).render(msg);
+    detail::backendLog(backend_, line, lev);
+
+    if(owner){
+        local.busy = false;
+    }
+}
+
+template<typename B>
+void Coalesce<B>::runTimer(){
+    const std::chrono::nanoseconds interval(windowNs_ / 2 > 0 ? windowNs_ / 2 : 1);
+    std::unique_lock<std::mutex> lk(timerMtx_);
+    while(!stop_){
+        cv_.wait_for(lk, interval);
+        if(!stop_){
+            lk.unlock();
+            sweep(detail::monotonicNs(), false);
+            lk.lock();
+        }
+    }
+}
+
+template<typename B>
+size_t Coalesce<B>::roundSlots(size_t slots){
+    size_t ret = 2;
+    while(ret < slots){
+        ret <<= 1;
+    }
+    return ret;
+}
+
+namespace detail{
+
+// Like a Tee, a Coalesce renders the format around the message itself
+template<typename B>
+struct backendFormat<Coalesce<B>, llfmt>{
+    inline static const llfmt& get(){
+        return backendFormat<Tee, llfmt>::get();
+    }
+};
+
+} // namespace detail
+
+}
@@ -0,0 +1,265 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+#include <charconv>
+#include <string_view>
+#define LL_HAS_CHARCONV 1
+#endif
+
+#include "msgBuf.hpp"
+
+namespace ll{
+
+namespace detail{
+
+// Width and precision set by the manipulators below. They apply to the
+// message they appear in and never touch the state of any stream.
+struct fmtSpec{
+    int width = 0;
+    int precision = 6;
+    char fill = ' ';
+};
+
+struct widthManip{
+    int width;
+    char fill;
+};
+
+struct precisionManip{
+    int precision;
+};
+
+template<typename T>
+struct hexManip{
+    T value;
+};
+
+} // namespace detail
+
+// Pad the next value to at least w characters
+inline detail::widthManip width(int w, char fill = ' '){
+    return {w, fill};
+}
+
+// Significant digits of the floating point values that follow
+inline detail::precisionManip precision(int p){
+    return {p};
+}
+
+// Print an integer in lowercase hexadecimal, without prefix
+template<typename T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type = true>
+inline detail::hexManip<T> hex(T value){
+    return {value};
+}
+
+namespace detail{
+
+template<typename T>
+struct isCharLike: std::integral_constant<bool,
+    std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+    std::is_same<T, unsigned char>::value || std::is_same<T, wchar_t>::value ||
+    std::is_same<T, char16_t>::value || std::is_same<T, char32_t>::value>{};
+
+template<typename T>
+struct isFastInt: std::integral_constant<bool,
+    std::is_integral<T>::value && !std::is_same<T, bool>::value && !isCharLike<T>::value>{};
+
+inline void padTo(msgBuf& buf, size_t len, fmtSpec& spec){
+    if(spec.width > 0){
+        if(static_cast<size_t>(spec.width) > len){
+            size_t pad = static_cast<size_t>(spec.width) - len;
+            std::memset(buf.reserve(pad), spec.fill, pad);
+            buf.commit(pad);
+        }
+        spec.width = 0;
+    }
+}
+
+inline void putPadded(msgBuf& buf, const char* str, size_t len, fmtSpec& spec){
+    padTo(buf, len, spec);
+    buf.append(str, len);
+}
+
+// Decimal digits of value written backwards ending at end
+inline char* writeDec(char* end, unsigned long long value){
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    while(value >= 100){
+        const unsigned idx = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--end = digits[idx + 1];
+        *--end = digits[idx];
+    }
+    if(value >= 10){
+        const unsigned idx = static_cast<unsigned>(value) * 2;
+        *--end = digits[idx + 1];
+        *--end = digits[idx];
+    }else{
+        *--end = static_cast<char>('0' + value);
+    }
+    return end;
+}
+
+inline char* writeHex(char* end, unsigned long long value){
+    do{
+        *--end = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }while(value != 0);
+    return end;
+}
+
+template<typename T, typename std::enable_if<isFastInt<T>::value, bool>::type = true>
+inline void fmtValue(msgBuf& buf, T value, fmtSpec& spec){
+    char text[24];
+#ifdef LL_HAS_CHARCONV
+    const size_t len = static_cast<size_t>(std::to_chars(text, text + sizeof(text), value).ptr - text);
+    putPadded(buf, text, len, spec);
+#else
+    char* end = text + sizeof(text);
+    unsigned long long mag = static_cast<unsigned long long>(value);
+    const bool neg = std::is_signed<T>::value && value < 0;
+    char* begin = writeDec(end, neg ? 0ULL - mag : mag);
+    if(neg){
+        *--begin = '-';
+    }
+    putPadded(buf, begin, static_cast<size_t>(end - begin), spec);
+#endif
+}
+
+template<typename T>
+inline void fmtValue(msgBuf& buf, const hexManip<T>& hex, fmtSpec& spec){
+    char text[24];
+    char* end = text + sizeof(text);
+    using U = typename std::make_unsigned<T>::type;
+    char* begin = writeHex(end, static_cast<U>(hex.value));
+    putPadded(buf, begin, static_cast<size_t>(end - begin), spec);
+}
+
+template<typename T, typename std::enable_if<std::is_floating_point<T>::value, bool>::type = true>
+inline void fmtValue(msgBuf& buf, T value, fmtSpec& spec){
+    // Same output as std::ostream with default flags, i.e. %g
+    char text[64];
+    size_t len;
+#if defined(LL_HAS_CHARCONV) && defined(__cpp_lib_to_chars)
+    auto res = std::to_chars(text, text + sizeof(text), value, std::chars_format::general, spec.precision);
+    if(res.ec != std::errc()){
+        len = static_cast<size_t>(std::snprintf(text, sizeof(text), "%.*Lg", spec.precision, static_cast<long double>(value)));
+    }else{
+        len = static_cast<size_t>(res.ptr - text);
+    }
+#else
+    int ret = std::snprintf(text, sizeof(text), "%.*Lg", spec.precision, static_cast<long double>(value));
+    len = ret < 0 ? 0 : static_cast<size_t>(ret);
+#endif
+    if(len >= sizeof(text)){
+        len = sizeof(text) - 1;
+    }
+    putPadded(buf, text, len, spec);
+}
+
+inline void fmtValue(msgBuf& buf, bool value, fmtSpec& spec){
+    putPadded(buf, value ? "1" : "0", 1, spec);
+}
+
+inline void fmtValue(msgBuf& buf, char value, fmtSpec& spec){
+    putPadded(buf, &value, 1, spec);
+}
+
+inline void fmtValue(msgBuf& buf, signed char value, fmtSpec& spec){
+    fmtValue(buf, static_cast<char>(value), spec);
+}
+
+inline void fmtValue(msgBuf& buf, unsigned char value, fmtSpec& spec){
+    fmtValue(buf, static_cast<char>(value), spec);
+}
+
+inline void fmtValue(msgBuf& buf, const char* str, fmtSpec& spec){
+    if(str != nullptr){
+        putPadded(buf, str, std::strlen(str), spec);
+    }
+}
+
+inline void fmtValue(msgBuf& buf, const std::string& str, fmtSpec& spec){
+    putPadded(buf, str.data(), str.size(), spec);
+}
+
+#ifdef LL_HAS_CHARCONV
+inline void fmtValue(msgBuf& buf, std::string_view str, fmtSpec& spec){
+    putPadded(buf, str.data(), str.size(), spec);
+}
+#endif
+
+// Pointers other than C strings print as 0x-prefixed hexadecimal
+template<typename P, typename std::enable_if<
+    !isCharLike<typename std::remove_cv<P>::type>::value && !std::is_function<P>::value, bool>::type = true>
+inline void fmtValue(msgBuf& buf, P* ptr, fmtSpec& spec){
+    char text[24];
+    char* end = text + sizeof(text);
+    char* begin = end;
+    if(ptr == nullptr){
+        *--begin = '0';
+    }else{
+        begin = writeHex(end, reinterpret_cast<uintptr_t>(ptr));
+        *--begin = 'x';
+        *--begin = '0';
+    }
+    putPadded(buf, begin, static_cast<size_t>(end - begin), spec);
+}
+
+inline void fmtValue(msgBuf&, const widthManip& manip, fmtSpec& spec){
+    spec.width = manip.width;
+    spec.fill = manip.fill;
+}
+
+inline void fmtValue(msgBuf&, const precisionManip& manip, fmtSpec& spec){
+    spec.precision = manip.precision;
+}
+
+template<typename T>
+struct isFastStr: std::integral_constant<bool,
+    std::is_same<T, std::string>::value
+#ifdef LL_HAS_CHARCONV
+    || std::is_same<T, std::string_view>::value
+#endif
+    >{};
+
+template<typename T>
+struct isFastPtr: std::false_type{};
+
+template<typename P>
+struct isFastPtr<P*>: std::integral_constant<bool,
+    std::is_same<typename std::remove_const<P>::type, char>::value ||
+    (!isCharLike<typename std::remove_cv<P>::type>::value && !std::is_function<P>::value &&
+     !std::is_volatile<P>::value)>{};
+
+template<typename T>
+struct isManip: std::integral_constant<bool,
+    std::is_same<T, widthManip>::value || std::is_same<T, precisionManip>::value>{};
+
+template<typename T>
+struct isManip<hexManip<T> >: std::true_type{};
+
+// Whether T has a formatter above, or has to go through std::ostream.
+// Only exact types are matched, so that classes convertible to one of
+// them still reach their own operator <<.
+template<typename T, typename U = typename std::decay<T>::type>
+struct hasFastFmt: std::integral_constant<bool,
+    isFastInt<U>::value || std::is_floating_point<U>::value || std::is_same<U, bool>::value ||
+    std::is_same<U, char>::value || std::is_same<U, signed char>::value ||
+    std::is_same<U, unsigned char>::value || isFastStr<U>::value ||
+    isFastPtr<U>::value || isManip<U>::value>{};
+
+} // namespace detail
+
+}
@@ -0,0 +1,70 @@
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace ll{
+
+namespace detail{
+
+// Write all of iov, resuming after signals and short writes, at offset with
+// pwritev or, when offset is negative, at the file position with writev.
+// The entries of iov are advanced past the bytes written. Short writes
+// only happen on errors such as a full disk, which return false.
+inline bool writeAllv(int fd, iovec* iov, int count, int64_t offset = -1){
+    while(count > 0){
+        ssize_t ret = offset < 0 ? ::writev(fd, iov, count) : ::pwritev(fd, iov, count, static_cast<off_t>(offset));
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        size_t done = static_cast<size_t>(ret);
+        if(offset >= 0){
+            offset += ret;
+        }
+        while(count > 0 && done >= iov->iov_len){
+            done -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count > 0){
+            iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+inline bool writeAll(int fd, const void* buf, size_t len){
+    iovec iov{const_cast<void*>(buf), len};
+    return writeAllv(fd, &iov, 1);
+}
+
+inline bool preadAll(int fd, void* buf, size_t len, uint64_t offset){
+    char* p = static_cast<char*>(buf);
+    while(len > 0){
+        ssize_t ret = ::pread(fd, p, len, static_cast<off_t>(offset));
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        p += ret;
+        len -= static_cast<size_t>(ret);
+        offset += static_cast<uint64_t>(ret);
+    }
+    return true;
+}
+
+} // namespace detail
+
+}
@@ -0,0 +1,371 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LL_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "fileIo.hpp"
+#include "lldefs.h"
+
+namespace ll{
+
+// When FileSink moves the current file aside and starts a new one
+struct rotatePolicy{
+    // Size of the file triggering a rotation, 0 disables
+    size_t bytes;
+    // Rotate at every multiple of interval since the epoch, 0 disables
+    std::chrono::seconds interval;
+    // Rotated files kept, older ones are deleted
+    size_t keep;
+    // gzip rotated files, requires LL_WITH_ZLIB and linking zlib
+    bool compress;
+
+    inline rotatePolicy(size_t bytes = 0,
+                        std::chrono::seconds interval = std::chrono::seconds(0),
+                        size_t keep = 8,
+                        bool compress = true);
+};
+
+rotatePolicy::rotatePolicy(size_t bytes, std::chrono::seconds interval, size_t keep, bool compress):
+                           bytes(bytes),
+                           interval(interval),
+                           keep(keep),
+                           compress(compress){
+}
+
+// Backend appending lines to a file on an O_APPEND descriptor. Lines logged
+// while another thread writes are gathered and written by the next writer
+// in a single call. Rotation runs on a background thread: the file is
+// renamed, a new one is opened and swapped in, and the old descriptor is
+// closed once no logging thread uses it any more.
+class FileSink{
+  public:
+    inline FileSink(const std::string& path, const rotatePolicy& policy = rotatePolicy());
+    FileSink(const FileSink&) = delete;
+    inline ~FileSink();
+
+    inline void log(const std::string& str, level lev);
+    // Ask the background thread to rotate now
+    inline void rotate();
+    inline unsigned long long errors() const;
+
+  private:
+    struct fdSlot{
+        std::atomic<int> fd;
+        std::atomic<int> users;
+    };
+
+    const std::string path_;
+    const rotatePolicy policy_;
+
+    // The descriptor in use is slots_[gen_ & 1]
+    fdSlot slots_[2];
+    std::atomic<unsigned> gen_;
+    std::atomic<unsigned long long> size_;
+    std::atomic<unsigned long long> errors_;
+    std::atomic<bool> rotateReq_;
+
+    // Lines are appended to pending_ under pendingMtx_. The thread writing
+    // them out holds writeMtx_ and swaps pending_ with spare_, as
+    // OStreamSync does.
+    std::mutex pendingMtx_;
+    std::mutex writeMtx_;
+    std::string pending_;
+    std::string spare_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_;
+    std::thread rotator_;
+
+    inline int openFile();
+    inline void writeAll(int fd, const std::string& str);
+    inline void run();
+    inline void doRotate();
+    inline std::string archiveName() const;
+    inline void compress(const std::string& archive);
+    inline void prune();
+};
+
+FileSink::FileSink(const std::string& path, const rotatePolicy& policy): path_(path),
+                                                                         policy_(policy),
+                                                                         gen_(0),
+                                                                         size_(0),
+                                                                         errors_(0),
+                                                                         rotateReq_(false),
+                                                                         stop_(false){
+    int fd = openFile();
+    slots_[0].fd.store(fd);
+    slots_[0].users.store(0);
+    slots_[1].fd.store(-1);
+    slots_[1].users.store(0);
+
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0){
+        size_.store(static_cast<unsigned long long>(st.st_size));
+    }
+
+    if(policy_.bytes > 0 || policy_.interval.count() > 0){
+        rotator_ = std::thread(&FileSink::run, this);
+    }
+}
+
+FileSink::~FileSink(){
+    if(rotator_.joinable()){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        rotator_.join();
+    }
+
+    for(fdSlot& slot: slots_){
+        int fd = slot.fd.load();
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+}
+
+void FileSink::log(const std::string& str, level){
+    {
+        std::lock_guard<std::mutex> lk(pendingMtx_);
+        pending_.append(str);
+        pending_.push_back('\n');
+    }
+
+    std::lock_guard<std::mutex> wlk(writeMtx_);
+    {
+        std::lock_guard<std::mutex> lk(pendingMtx_);
+        // Written along with the lines of the previous writer
+        if(pending_.empty()){
+            return;
+        }
+        pending_.swap(spare_);
+    }
+
+    unsigned gen;
+    fdSlot* slot;
+    for(;;){
+        gen = gen_.load();
+        slot = &slots_[gen & 1];
+        slot->users.fetch_add(1);
+        // The rotator closes a descriptor only after moving gen_ past it
+        // and seeing no users, so re-checking gen_ makes this one safe
+        if(gen_.load() == gen){
+            break;
+        }
+        slot->users.fetch_sub(1);
+    }
+
+    writeAll(slot->fd.load(std::memory_order_relaxed), spare_);
+    slot->users.fetch_sub(1, std::memory_order_release);
+
+    const unsigned long long size = size_.fetch_add(spare_.size(), std::memory_order_relaxed) + spare_.size();
+    spare_.clear();
+    if(policy_.bytes > 0 && size >= policy_.bytes && !rotateReq_.load(std::memory_order_relaxed) &&
+       !rotateReq_.exchange(true)){
+        cv_.notify_one();
+    }
+}
+
+void FileSink::rotate(){
+    rotateReq_.store(true);
+    std::lock_guard<std::mutex> lk(mtx_);
+    cv_.notify_one();
+}
+
+unsigned long long FileSink::errors() const{
+    return errors_.load(std::memory_order_relaxed);
+}
+
+int FileSink::openFile(){
+    int fd = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return fd;
+}
+
+void FileSink::writeAll(int fd, const std::string& str){
+    if(fd < 0 || !detail::writeAll(fd, str.data(), str.size())){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void FileSink::run(){
+    using namespace std::chrono;
+    const long long period = duration_cast<milliseconds>(policy_.interval).count();
+    auto nowMs = []{
+        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    };
+    long long deadline = period > 0 ? (nowMs() / period + 1) * period : 0;
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    while(!stop_){
+        auto wait = milliseconds(500);
+        bool due = false;
+        if(period > 0){
+            const long long now = nowMs();
+            if(now >= deadline){
+                due = true;
+                deadline = (now / period + 1) * period;
+            }
+            wait = std::min(wait, milliseconds(deadline - now));
+        }
+
+        if(due || rotateReq_.load()){
+            lk.unlock();
+            doRotate();
+            lk.lock();
+            continue;
+        }
+        cv_.wait_for(lk, wait);
+    }
+}
+
+void FileSink::doRotate(){
+    // Nothing was written since the last rotation
+    if(size_.load() == 0){
+        rotateReq_.store(false);
+        return;
+    }
+
+    const std::string archive = archiveName();
+    if(::rename(path_.c_str(), archive.c_str()) != 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        rotateReq_.store(false);
+        return;
+    }
+
+    // Logging threads keep appending to the renamed file until the swap
+    const unsigned gen = gen_.load();
+    fdSlot& prev = slots_[gen & 1];
+    slots_[(gen + 1) & 1].fd.store(openFile());
+    size_.store(0);
+    gen_.store(gen + 1);
+    rotateReq_.store(false);
+
+    while(prev.users.load() != 0){
+        std::this_thread::yield();
+    }
+    int fd = prev.fd.exchange(-1);
+    if(fd >= 0){
+        close(fd);
+    }
+
+    if(policy_.compress){
+        compress(archive);
+    }
+    prune();
+}
+
+std::string FileSink::archiveName() const{
+    std::time_t now = std::time(nullptr);
+    std::tm tm;
+    localtime_r(&now, &tm);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), ".%Y%m%d-%H%M%S", &tm);
+
+    std::string ret = path_ + stamp;
+    struct stat st;
+    for(int i = 1; ::stat(ret.c_str(), &st) == 0 ||
+                   ::stat((ret + ".gz").c_str(), &st) == 0; ++i){
+        ret = path_ + stamp + "." + std::to_string(i);
+    }
+    return ret;
+}
+
+void FileSink::compress(const std::string& archive){
+#ifdef LL_WITH_ZLIB
+    int in = ::open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0){
+        return;
+    }
+    const std::string gzName = archive + ".gz";
+    gzFile out = gzopen(gzName.c_str(), "wb6");
+    if(out == nullptr){
+        close(in);
+        return;
+    }
+
+    std::vector<char> buf(1 << 16);
+    bool ok = true;
+    ssize_t len;
+    while((len = read(in, buf.data(), buf.size())) > 0){
+        if(gzwrite(out, buf.data(), static_cast<unsigned>(len)) != len){
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && len == 0;
+    close(in);
+    ok = gzclose(out) == Z_OK && ok;
+
+    ::unlink(ok ? archive.c_str() : gzName.c_str());
+    if(!ok){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+#else
+    (void)archive;
+#endif
+}
+
+void FileSink::prune(){
+    const size_t slash = path_.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash + 1);
+    const std::string prefix = (slash == std::string::npos ? path_ : path_.substr(slash + 1)) + ".";
+
+    DIR* d = opendir(dir.c_str());
+    if(d == nullptr){
+        return;
+    }
+    std::vector<std::string> archives;
+    while(dirent* ent = readdir(d)){
+        std::string name(ent->d_name);
+        // Rotated files are named <file>.YYYYmmdd-HHMMSS[.n][.gz]
+        if(name.size() >= prefix.size() + 15 && name.compare(0, prefix.size(), prefix) == 0 &&
+           name[prefix.size() + 8] == '-'){
+            archives.push_back(name);
+        }
+    }
+    closedir(d);
+
+    if(archives.size() > policy_.keep){
+        // Oldest first: by timestamp, then by the suffix added on collisions
+        const size_t stampEnd = prefix.size() + 15;
+        auto seq = [stampEnd](const std::string& name){
+            return name.size() > stampEnd + 1 && name[stampEnd] == '.' ?
+                   std::atol(name.c_str() + stampEnd + 1) : 0L;
+        };
+        std::sort(archives.begin(), archives.end(),
+                  [stampEnd, &seq](const std::string& a, const std::string& b){
+            int cmp = a.compare(0, stampEnd, b, 0, stampEnd);
+            return cmp != 0 ? cmp < 0 : seq(a) < seq(b);
+        });
+        for(size_t i = 0; i < archives.size() - policy_.keep; ++i){
+            std::string victim = slash == std::string::npos ? archives[i] : dir + archives[i];
+            ::unlink(victim.c_str());
+        }
+    }
+}
+
+}
@@ -0,0 +1,319 @@
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#else
+#include <functional>
+#include <thread>
+#endif
+
+#include "fastFmt.hpp"
+#include "msgBuf.hpp"
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_FILE) && __has_builtin(__builtin_LINE)
+#define LL_HAS_BUILTIN_LOC 1
+#endif
+#elif defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define LL_HAS_BUILTIN_LOC 1
+#endif
+
+namespace ll{
+
+// Call site of a logging statement, filled in by default arguments of
+// llogger::operator(). Empty where the compiler lacks the builtins.
+struct sourceLoc{
+    const char* file;
+    unsigned line;
+
+#ifdef LL_HAS_BUILTIN_LOC
+    inline static sourceLoc current(const char* file = __builtin_FILE(), unsigned line = __builtin_LINE());
+#else
+    inline static sourceLoc current(const char* file = "", unsigned line = 0);
+#endif
+};
+
+sourceLoc sourceLoc::current(const char* file, unsigned line){
+    return {file, line};
+}
+
+// Handle through which append callbacks of a format write into the line
+class fmtWriter{
+  public:
+    inline fmtWriter(detail::msgBuf& buf, const sourceLoc& loc);
+
+    inline void append(const char* data, size_t len);
+    inline void append(const std::string& str);
+    // Values with a built-in formatter: integers, floating point, bool,
+    // characters, strings and pointers
+    template<typename T, typename std::enable_if<detail::hasFastFmt<T>::value, bool>::type = true>
+    inline fmtWriter& operator << (const T& value);
+
+    // Call site of the message, or an empty file and line 0 if unknown
+    inline const sourceLoc& source() const;
+
+  private:
+    detail::msgBuf& buf_;
+    const sourceLoc& loc_;
+};
+
+fmtWriter::fmtWriter(detail::msgBuf& buf, const sourceLoc& loc): buf_(buf),
+                                                                  loc_(loc){
+}
+
+void fmtWriter::append(const char* data, size_t len){
+    buf_.append(data, len);
+}
+
+void fmtWriter::append(const std::string& str){
+    buf_.append(str);
+}
+
+template<typename T, typename std::enable_if<detail::hasFastFmt<T>::value, bool>::type>
+fmtWriter& fmtWriter::operator << (const T& value){
+    detail::fmtSpec spec;
+    detail::fmtValue(buf_, value, spec);
+    return *this;
+}
+
+const sourceLoc& fmtWriter::source() const{
+    return loc_;
+}
+
+namespace detail{
+
+// Callable taking a fmtWriter&, stored in place when it fits in a few
+// words and on the heap otherwise
+class fmtAppender{
+  public:
+    template<typename Fn, typename std::enable_if<
+        !std::is_same<typename std::decay<Fn>::type, fmtAppender>::value, bool>::type = true>
+    inline fmtAppender(Fn&& fn);
+    inline fmtAppender(const fmtAppender& other);
+    inline fmtAppender& operator = (const fmtAppender& other);
+    inline ~fmtAppender();
+
+    inline void operator() (fmtWriter& writer) const;
+
+  private:
+    static constexpr size_t inlineSize = 4 * sizeof(void*);
+
+    template<typename T>
+    using fitsInline = std::integral_constant<bool,
+        sizeof(T) <= inlineSize && alignof(T) <= alignof(std::max_align_t)>;
+
+    struct ops{
+        void (*call)(void* fn, fmtWriter& writer);
+        void (*copy)(const void* from, void* to);
+        void (*destroy)(void* fn);
+    };
+
+    template<typename Fn>
+    struct inlineOps{
+        inline static void call(void* fn, fmtWriter& writer);
+        inline static void copy(const void* from, void* to);
+        inline static void destroy(void* fn);
+        static constexpr ops table{&call, &copy, &destroy};
+    };
+
+    template<typename Fn>
+    struct heapOps{
+        inline static void call(void* fn, fmtWriter& writer);
+        inline static void copy(const void* from, void* to);
+        inline static void destroy(void* fn);
+        static constexpr ops table{&call, &copy, &destroy};
+    };
+
+    alignas(std::max_align_t) mutable unsigned char storage_[inlineSize];
+    const ops* ops_;
+
+    template<typename Fn>
+    inline void store(Fn&& fn, std::true_type);
+    template<typename Fn>
+    inline void store(Fn&& fn, std::false_type);
+};
+
+template<typename Fn>
+constexpr fmtAppender::ops fmtAppender::inlineOps<Fn>::table;
+
+template<typename Fn>
+constexpr fmtAppender::ops fmtAppender::heapOps<Fn>::table;
+
+template<typename Fn, typename std::enable_if<
+    !std::is_same<typename std::decay<Fn>::type, fmtAppender>::value, bool>::type>
+fmtAppender::fmtAppender(Fn&& fn){
+    store(std::forward<Fn>(fn), fitsInline<typename std::decay<Fn>::type>());
+}
+
+template<typename Fn>
+void fmtAppender::store(Fn&& fn, std::true_type){
+    using T = typename std::decay<Fn>::type;
+    new(storage_) T(std::forward<Fn>(fn));
+    ops_ = &inlineOps<T>::table;
+}
+
+template<typename Fn>
+void fmtAppender::store(Fn&& fn, std::false_type){
+    using T = typename std::decay<Fn>::type;
+    T* heap = new T(std::forward<Fn>(fn));
+    std::memcpy(storage_, &heap, sizeof(heap));
+    ops_ = &heapOps<T>::table;
+}
+
+fmtAppender::fmtAppender(const fmtAppender& other): ops_(other.ops_){
+    ops_->copy(other.storage_, storage_);
+}
+
+fmtAppender& fmtAppender::operator = (const fmtAppender& other){
+    if(this != &other){
+        ops_->destroy(storage_);
+        ops_ = other.ops_;
+        ops_->copy(other.storage_, storage_);
+    }
+    return *this;
+}
+
+fmtAppender::~fmtAppender(){
+    ops_->destroy(storage_);
+}
+
+void fmtAppender::operator() (fmtWriter& writer) const{
+    // Like std::function, a mutable callable may change its state
+    ops_->call(storage_, writer);
+}
+
+template<typename Fn>
+void fmtAppender::inlineOps<Fn>::call(void* fn, fmtWriter& writer){
+    (*static_cast<Fn*>(fn))(writer);
+}
+
+template<typename Fn>
+void fmtAppender::inlineOps<Fn>::copy(const void* from, void* to){
+    new(to) Fn(*static_cast<const Fn*>(from));
+}
+
+template<typename Fn>
+void fmtAppender::inlineOps<Fn>::destroy(void* fn){
+    static_cast<Fn*>(fn)->~Fn();
+}
+
+template<typename Fn>
+void fmtAppender::heapOps<Fn>::call(void* fn, fmtWriter& writer){
+    Fn* heap;
+    std::memcpy(&heap, fn, sizeof(heap));
+    (*heap)(writer);
+}
+
+template<typename Fn>
+void fmtAppender::heapOps<Fn>::copy(const void* from, void* to){
+    const Fn* heap;
+    std::memcpy(&heap, from, sizeof(heap));
+    Fn* copied = new Fn(*heap);
+    std::memcpy(to, &copied, sizeof(copied));
+}
+
+template<typename Fn>
+void fmtAppender::heapOps<Fn>::destroy(void* fn){
+    Fn* heap;
+    std::memcpy(&heap, fn, sizeof(heap));
+    delete heap;
+}
+
+// Id of the calling thread as shown by the system tools where known
+inline long long threadId(){
+#ifdef __linux__
+    static thread_local long long ret = 0;
+    if(ret == 0){
+        ret = static_cast<long long>(syscall(SYS_gettid));
+    }
+    return ret;
+#else
+    static thread_local long long ret = static_cast<long long>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return ret;
+#endif
+}
+
+inline long long processId(){
+#ifdef _WIN32
+    return static_cast<long long>(_getpid());
+#else
+    // Cached, and read again in the child after a fork
+    static std::atomic<long long> cached(0);
+    static const int registered = pthread_atfork(nullptr, nullptr, []{
+        cached.store(0, std::memory_order_relaxed);
+    });
+    (void)registered;
+    long long ret = cached.load(std::memory_order_relaxed);
+    if(ret == 0){
+        ret = static_cast<long long>(getpid());
+        cached.store(ret, std::memory_order_relaxed);
+    }
+    return ret;
+#endif
+}
+
+// Built-in append callbacks
+struct putThreadId{
+    inline void operator() (fmtWriter& writer) const{
+        writer << threadId();
+    }
+};
+
+struct putProcessId{
+    inline void operator() (fmtWriter& writer) const{
+        writer << processId();
+    }
+};
+
+// file:line of the call site, without the directories of the file
+struct putSource{
+    inline void operator() (fmtWriter& writer) const{
+        const sourceLoc& loc = writer.source();
+        if(loc.line == 0){
+            return;
+        }
+        const char* file = loc.file;
+        for(const char* p = file; *p != '\0'; ++p){
+            if(*p == '/' || *p == '\\'){
+                file = p + 1;
+            }
+        }
+        writer.append(file, std::strlen(file));
+        writer << ':' << loc.line;
+    }
+};
+
+// Number of the message among those rendered with the same format and
+// its copies, starting at 1
+class putSeq{
+  public:
+    inline putSeq(): count_(std::make_shared<std::atomic<unsigned long long> >(0)){
+    }
+
+    inline void operator() (fmtWriter& writer) const{
+        writer << count_->fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+  private:
+    std::shared_ptr<std::atomic<unsigned long long> > count_;
+};
+
+} // namespace detail
+
+}
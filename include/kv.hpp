@@ -0,0 +1,249 @@
+
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fastFmt.hpp"
+#include "lldefs.h"
+#include "msgBuf.hpp"
+
+namespace ll{
+
+// How the message and its kv fields are written, chosen by the logStr
+// segment of the format: llfmt::logStr, llfmt::jsonStr or llfmt::logfmtStr
+enum kvEncoding: char{
+    plain,  // Fields inline in the text as key=value
+    json,   // "msg":"text","key":value,...
+    logfmt  // msg="text" key=value ...
+};
+
+namespace detail{
+
+template<typename T>
+struct kvPair{
+    const char* key;
+    const T& value;
+};
+
+template<typename T>
+struct isKv: std::false_type{};
+
+template<typename T>
+struct isKv<kvPair<T> >: std::true_type{};
+
+} // namespace detail
+
+// Structured field of a message: logger(ll::info) << ll::kv("user", id)
+template<typename T>
+inline detail::kvPair<T> kv(const char* key, const T& value){
+    return {key, value};
+}
+
+namespace detail{
+
+// Values written unquoted in JSON
+template<typename T, typename U = typename std::decay<T>::type>
+struct kvIsBare: std::integral_constant<bool,
+    isFastInt<U>::value || std::is_floating_point<U>::value || std::is_same<U, bool>::value>{};
+
+template<typename T, typename std::enable_if<std::is_floating_point<T>::value, bool>::type = true>
+inline bool kvFinite(const T& value){
+    return std::isfinite(value);
+}
+
+template<typename T, typename std::enable_if<!std::is_floating_point<T>::value, bool>::type = true>
+inline bool kvFinite(const T&){
+    return true;
+}
+
+// First byte in [p, end) that is below lt as a signed char, i.e. a
+// control character or any non-ASCII byte, or equal to a, b or c
+inline const char* findSpecial(const char* p, const char* end, char lt, char a, char b, char c){
+#if defined(__AVX2__)
+    const __m256i vlt = _mm256_set1_epi8(lt);
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+    for(; end - p >= 32; p += 32){
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi8(vlt, v), _mm256_cmpeq_epi8(v, va)),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(v, vb), _mm256_cmpeq_epi8(v, vc)));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if(mask != 0){
+            return p + lowestBit(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i vlt = _mm_set1_epi8(lt);
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    for(; end - p >= 16; p += 16){
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, vlt), _mm_cmpeq_epi8(v, va)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(v, vb), _mm_cmpeq_epi8(v, vc)));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+        if(mask != 0){
+            return p + lowestBit(mask);
+        }
+    }
+#endif
+    for(; p != end; ++p){
+        if(static_cast<signed char>(*p) < static_cast<signed char>(lt) || *p == a || *p == b || *p == c){
+            return p;
+        }
+    }
+    return end;
+}
+
+// Length of the valid UTF-8 sequence starting at p, or 0
+inline size_t utf8Len(const unsigned char* p, const unsigned char* end){
+    const unsigned char c = *p;
+    size_t len;
+    unsigned min;
+    if(c >= 0xc2 && c <= 0xdf){
+        len = 2;
+        min = 0x80;
+    }else if(c >= 0xe0 && c <= 0xef){
+        len = 3;
+        min = 0x800;
+    }else if(c >= 0xf0 && c <= 0xf4){
+        len = 4;
+        min = 0x10000;
+    }else{
+        return 0;
+    }
+    if(static_cast<size_t>(end - p) < len){
+        return 0;
+    }
+
+    unsigned cp = c & (0x7f >> len);
+    for(size_t i = 1; i < len; ++i){
+        if((p[i] & 0xc0) != 0x80){
+            return 0;
+        }
+        cp = cp << 6 | (p[i] & 0x3f);
+    }
+    if(cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)){
+        return 0;
+    }
+    return len;
+}
+
+// Append [p, end) to out as the inside of a double-quoted string. Valid
+// UTF-8 is copied as is, and invalid bytes are replaced by U+FFFD.
+inline void escapeTo(msgBuf& out, const char* p, const char* end, kvEncoding enc){
+    for(;;){
+        const char* hit = findSpecial(p, end, 0x20, '"', '\\', '\\');
+        out.append(p, static_cast<size_t>(hit - p));
+        if(hit == end){
+            return;
+        }
+
+        const unsigned char c = static_cast<unsigned char>(*hit);
+        p = hit + 1;
+        if(c >= 0x80){
+            const size_t len = utf8Len(reinterpret_cast<const unsigned char*>(hit),
+                                       reinterpret_cast<const unsigned char*>(end));
+            if(len != 0){
+                out.append(hit, len);
+                p = hit + len;
+            }else if(enc == json){
+                out.append("\\ufffd", 6);
+            }else{
+                out.append("\xef\xbf\xbd", 3);
+            }
+            continue;
+        }
+
+        char esc[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t len = 2;
+        switch(c){
+            case '"':  esc[1] = '"';  break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n';  break;
+            case '\r': esc[1] = 'r';  break;
+            case '\t': esc[1] = 't';  break;
+            case '\b': esc[1] = 'b';  break;
+            case '\f': esc[1] = 'f';  break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = "0123456789abcdef"[c >> 4];
+                esc[5] = "0123456789abcdef"[c & 0xf];
+                len = 6;
+        }
+        out.append(esc, len);
+    }
+}
+
+// Whether a logfmt value has to be quoted
+inline bool logfmtQuote(const char* p, const char* end){
+    return p == end || findSpecial(p, end, 0x21, '"', '=', '\\') != end;
+}
+
+// Append a logfmt key, which cannot be quoted: spaces, control
+// characters, '=', '"' and '\\' are replaced with '_', and an empty key
+// is written as "_"
+inline void logfmtKey(msgBuf& out, const char* p, const char* end){
+    if(p == end){
+        out.push_back('_');
+        return;
+    }
+    for(;;){
+        const char* hit = findSpecial(p, end, 0x21, '"', '=', '\\');
+        out.append(p, static_cast<size_t>(hit - p));
+        if(hit == end){
+            return;
+        }
+        // Non-ASCII bytes are kept
+        out.push_back(static_cast<unsigned char>(*hit) >= 0x80 ? *hit : '_');
+        p = hit + 1;
+    }
+}
+
+// Escape buf[from, size) in place, using scratch as temporary storage
+// when anything has to change. Returns whether it did.
+inline bool escapeTail(msgBuf& buf, size_t from, msgBuf& scratch, kvEncoding enc){
+    const char* end = buf.data() + buf.size();
+    const char* hit = findSpecial(buf.data() + from, end, 0x20, '"', '\\', '\\');
+    if(hit == end){
+        return false;
+    }
+
+    const size_t at = static_cast<size_t>(hit - buf.data());
+    const size_t mark = scratch.size();
+    scratch.append(hit, static_cast<size_t>(end - hit));
+    buf.resize(at);
+    escapeTo(buf, scratch.data() + mark, scratch.data() + scratch.size(), enc);
+    scratch.resize(mark);
+    return true;
+}
+
+// Thread-local buffer holding the encoded fields of a message until they
+// are appended after its text
+struct kvFields{
+    msgBuf buf;
+    bool busy = false;
+
+    inline static kvFields& local();
+};
+
+kvFields& kvFields::local(){
+    static thread_local kvFields ret;
+    return ret;
+}
+
+} // namespace detail
+
+}
@@ -1,7 +1,110 @@
 #pragma once
 
+#include <string>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Polyfill of C++17 features
+#if !((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+#include "invoke.hpp"
+#endif
+
+// Least severe level compiled in. Statements of less severe levels are
+// removed by the optimizer, e.g. -DLL_MIN_LEVEL=ll::info strips debug.
+#ifndef LL_MIN_LEVEL
+#define LL_MIN_LEVEL ll::debug
+#endif
+
+// Counters of the logging pipeline read through ll::Metrics, which
+// -DLL_METRICS=1 adds to the logging path
+#ifndef LL_METRICS
+#define LL_METRICS 0
+#endif
+
 namespace ll{
     enum level: signed char{
         silent = -1, fatal, error, warning, notice, info, debug, levels
     };
+
+    constexpr level minLevel = LL_MIN_LEVEL;
+    constexpr bool metricsEnabled = LL_METRICS;
+
+namespace detail{
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+    template<typename F, typename ...Args>
+    using invokeResult = std::invoke_result_t<F, Args...>;
+
+    template<typename F, typename ...Args>
+    using isCallable = std::is_invocable<F, Args...>;
+#else
+    template<typename F, typename ...Args>
+    using invokeResult = invoke_hpp::invoke_result_t<F, Args...>;
+
+    template<typename F, typename ...Args>
+    using isCallable = invoke_hpp::is_invocable<F, Args...>;
+#endif
+
+    // Index of the lowest set bit of a nonzero mask
+    inline unsigned lowestBit(unsigned mask){
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#elif defined(_MSC_VER)
+        unsigned long ret;
+        _BitScanForward(&ret, mask);
+        return static_cast<unsigned>(ret);
+#else
+        unsigned ret = 0;
+        while((mask & 1) == 0){
+            mask >>= 1;
+            ++ret;
+        }
+        return ret;
+#endif
+    }
+
+    // Bits needed to write value, 0 for 0
+    inline unsigned bitLength(unsigned long long value){
+#if defined(__GNUC__)
+        return value == 0 ? 0 : 64 - static_cast<unsigned>(__builtin_clzll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long ret;
+        return _BitScanReverse64(&ret, value) ? static_cast<unsigned>(ret) + 1 : 0;
+#else
+        unsigned ret = 0;
+        for(; value != 0; value >>= 1){
+            ++ret;
+        }
+        return ret;
+#endif
+    }
+
+    // Forward a finished line to a backend of either log() signature
+    template <typename B, typename std::enable_if<
+        isCallable<decltype(&B::log), B&, const std::string&>::value, bool>::type = true>
+    inline void backendLog(B& backend, const std::string& str, level){
+        backend.log(str);
+    }
+
+    template <typename B, typename std::enable_if<
+        isCallable<decltype(&B::log), B&, const std::string&, level>::value, bool>::type = true>
+    inline void backendLog(B& backend, const std::string& str, level lev){
+        backend.log(str, lev);
+    }
+} // namespace detail
+
+    // Result of a rate limiting predicate: whether the message passes, and
+    // the messages dropped since the last one passed, which a llogger
+    // appends to it. Combined with other conditions it decays to a bool and
+    // the count is lost.
+    struct passed{
+        bool pass;
+        unsigned long long suppressed;
+
+        operator bool() const{
+            return pass;
+        }
+    };
 }
@@ -26,81 +26,118 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <ctime>
 #include <functional>
 #include <iomanip>
 #include <memory>
-#include <sstream>
 #include <string>
 #include <vector>
 
+#include "backtrace.hpp"
+#include "fastFmt.hpp"
+#include "fmtWriter.hpp"
+#include "kv.hpp"
 #include "lldefs.h"
+#include "metrics.hpp"
+#include "msgBuf.hpp"
 #include "osSync.hpp"
+#include "registry.hpp"
+#include "timestamp.hpp"
+#include "uidMap.hpp"
 
 namespace ll{
 
+class llfmt;
+
 namespace detail{
-// Polyfill of C++17 features
-#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
-    template<typename F, typename ...Args>
-    using invokeResult = std::invoke_result_t<F, Args...>;
-
-    template<typename F, typename ...Args>
-    using isCallable = std::is_invocable<F, Args...>;
-#else
-    #include "invoke.hpp"
-    template<typename F, typename ...Args>
-    using invokeResult = invoke_hpp::invoke_result_t<F, Args...>;
-
-    template<typename F, typename ...Args>
-    using isCallable = invoke_hpp::is_invocable<F, Args...>;
-#endif
 
-template<typename B>
+template<typename B, typename F = llfmt>
 struct logger;
 
+template <typename T>
+using isRetNonVoid =  typename std::enable_if<
+    !std::is_same<void, invokeResult<T> >::value, bool
+>::type;
+
 struct fmtItrs{
     using fmtCallback = std::function<std::string(void)>;
     std::vector<std::string>::const_iterator          fmtStrIter;
     std::vector<std::vector<size_t> >::const_iterator fmtOrdIter;
     std::vector<fmtCallback>::const_iterator          fmtLmbIter;
+    std::vector<fmtAppender>::const_iterator          fmtAppIter;
 };
 
 } // namespace detail
 
 class llfmt{
   public:
-    enum infoType: char{level = 1, time};
-    enum dataType: char{logStr};
+    // time renders seconds, timeMs/timeUs/timeNs append a sub-second part
+    enum infoType: char{level = 1, time, timeMs = 4, timeUs, timeNs};
+    // logStr inserts the message as is, jsonStr and logfmtStr as a msg
+    // field followed by the kv fields, and render the rest of the format
+    // after them
+    enum dataType: char{logStr, jsonStr, logfmtStr};
+    // Id of the logging thread (the kernel tid on Linux), process id,
+    // number of the message among those rendered with this format, and
+    // file:line of the logging statement
+    enum builtinType: char{threadId, pid, seq, source};
     using fmtCallback = std::function<std::string(void)>;
     using levelStrArr = std::array<const char *, levels>;
 
-    inline llfmt(const levelStrArr& levelNames = defaultLevelStr());
+    using state = detail::fmtItrs;
+
+    inline llfmt(const levelStrArr& levelNames = defaultLevelStr(), clockSource clock = realtime);
 
     inline const std::vector<size_t>& fmtOpt(detail::fmtItrs& state) const;
     inline detail::fmtItrs getIters() const;
+    // Render the segments up to the next logStr into logger lg
+    template<typename L>
+    inline void render(L& lg, detail::fmtItrs& state) const;
 
     inline llfmt& operator << (llfmt::infoType info);
     inline llfmt& operator << (llfmt::dataType);
     inline llfmt& operator << (const char* fmtStr);
     inline llfmt& operator << (const std::string& fmtStr);
     inline llfmt& operator << (const fmtCallback& fmtLmb);
+    inline llfmt& operator << (llfmt::builtinType builtin);
+    // Callback appending to the line through a fmtWriter&, which is kept
+    // without allocation when it holds no more than a few pointers
+    template<typename Fn, typename std::enable_if<
+        detail::isCallable<typename std::decay<Fn>::type&, fmtWriter&>::value, bool>::type = true>
+    inline llfmt& operator << (Fn&& fmtApp);
+
+    // Number of segments, one more than the logStr segments
+    inline size_t segments() const;
+    inline const levelStrArr& levelNames() const;
+    inline clockSource clock() const;
+    inline kvEncoding encoding() const;
+
+    inline static const levelStrArr& defaultLevelStr();
+    // Level names without color escapes, for files and pipes
+    inline static const levelStrArr& plainLevelStr();
+    // Lowercase level names, for JSON and logfmt
+    inline static const levelStrArr& lowerLevelStr();
 
   private:
-    template<typename>
+    template<typename, typename>
     friend class llogger;
 
-    template<typename>
+    template<typename, typename>
     friend class detail::logger;
+
+    friend class lineParser;
     
     std::vector<std::vector<size_t> > fmtOrds;
     std::vector<std::string>          fmtStrs;
     std::vector<fmtCallback>          fmtLmbs;
+    std::vector<detail::fmtAppender>  fmtApps;
 
     const levelStrArr& levelNames_;
-
-    inline static const levelStrArr& defaultLevelStr();
+    clockSource clock_;
+    kvEncoding encoding_;
 };
 
 const std::vector<size_t>& llfmt::fmtOpt(detail::fmtItrs& state) const{
@@ -111,12 +148,33 @@ detail::fmtItrs llfmt::getIters() const{
     return {
         fmtStrs.cbegin(),
         fmtOrds.cbegin(),
-        fmtLmbs.cbegin()
+        fmtLmbs.cbegin(),
+        fmtApps.cbegin()
     };
 }
 
-llfmt::llfmt(const levelStrArr& levelNames): levelNames_(levelNames),
-                                             fmtOrds(1){
+template<typename L>
+void llfmt::render(L& lg, detail::fmtItrs& state) const{
+    static const std::array<void (L::*)(detail::fmtItrs& state), 8> fmtCbs{
+        &L::putFmtStr, 
+        &L::putLogLev, 
+        &L::timeStamp, 
+        &L::putFmtLmb,
+        &L::timeStampMs,
+        &L::timeStampUs,
+        &L::timeStampNs,
+        &L::putFmtApp
+    };
+
+    for(size_t i: fmtOpt(state)){
+        (lg.*(fmtCbs[i]))(state);
+    }
+}
+
+llfmt::llfmt(const levelStrArr& levelNames, clockSource clock): fmtOrds(1),
+                                                               levelNames_(levelNames),
+                                                               clock_(clock),
+                                                               encoding_(plain){
 }
 
 llfmt& llfmt::operator << (llfmt::infoType info){
@@ -136,8 +194,13 @@ llfmt& llfmt::operator << (const std::string& fmtStr){
     return *this;
 }
 
-llfmt& llfmt::operator << (llfmt::dataType){
+llfmt& llfmt::operator << (llfmt::dataType data){
     fmtOrds.push_back(std::vector<size_t>());
+    if(data == jsonStr){
+        encoding_ = json;
+    }else if(data == logfmtStr){
+        encoding_ = logfmt;
+    }
     return *this;
 }
 
@@ -147,6 +210,43 @@ llfmt& llfmt::operator << (const fmtCallback& fmtLmb){
     return *this;
 }
 
+llfmt& llfmt::operator << (llfmt::builtinType builtin){
+    switch(builtin){
+        case threadId:
+            return *this << detail::putThreadId();
+        case pid:
+            return *this << detail::putProcessId();
+        case seq:
+            return *this << detail::putSeq();
+        default:
+            return *this << detail::putSource();
+    }
+}
+
+template<typename Fn, typename std::enable_if<
+    detail::isCallable<typename std::decay<Fn>::type&, fmtWriter&>::value, bool>::type>
+llfmt& llfmt::operator << (Fn&& fmtApp){
+    fmtOrds.back().push_back(7U);
+    fmtApps.emplace_back(std::forward<Fn>(fmtApp));
+    return *this;
+}
+
+size_t llfmt::segments() const{
+    return fmtOrds.size();
+}
+
+const llfmt::levelStrArr& llfmt::levelNames() const{
+    return levelNames_;
+}
+
+clockSource llfmt::clock() const{
+    return clock_;
+}
+
+kvEncoding llfmt::encoding() const{
+    return encoding_;
+}
+
 const llfmt::levelStrArr& llfmt::defaultLevelStr(){
     static constexpr llfmt::levelStrArr ret{
         "\033[1m\033[31m FATAL \033[0m", 
@@ -160,116 +260,358 @@ const llfmt::levelStrArr& llfmt::defaultLevelStr(){
     return ret;
 };
 
+const llfmt::levelStrArr& llfmt::plainLevelStr(){
+    static constexpr llfmt::levelStrArr ret{
+        " FATAL ",
+        " ERROR ",
+        "WARNING",
+        "NOTICE ",
+        " INFO  ",
+        " DEBUG "
+    };
+
+    return ret;
+}
+
+const llfmt::levelStrArr& llfmt::lowerLevelStr(){
+    static constexpr llfmt::levelStrArr ret{
+        "fatal",
+        "error",
+        "warning",
+        "notice",
+        "info",
+        "debug"
+    };
+
+    return ret;
+}
+
 enum fmtStrType: char{fmtStr};
 
-template<typename B = OStreamSync>
+namespace detail{
+
+// Format used by llogger when none is given
+template<typename F>
+inline const F& defaultFormat(){
+    static const F ret;
+    return ret;
+}
+
+// Level of the previous message of each llogger on the calling thread,
+// so that a llogger shared by threads is only read when logging
+inline level& stickyLevel(unsigned long long uid){
+    // Plain thread_local scalars need no initialization check on access
+    static thread_local unsigned long long lastUid = 0;
+    static thread_local level* last = nullptr;
+
+    if(lastUid != uid){
+        static thread_local uidMap<level> all;
+        last = &all.get(uid, info);
+        lastUid = uid;
+    }
+    return *last;
+}
+
+// Call site of the message being handed to a backend on this thread, for
+// the backends rendering their own format around it. Empty outside of
+// the llogger call, e.g. on the thread of an AsyncBackend.
+inline const sourceLoc*& dispatchLoc(){
+    static const sourceLoc none{"", 0};
+    static thread_local const sourceLoc* ret = &none;
+    return ret;
+}
+
+struct dispatchGuard{
+    const sourceLoc* previous;
+
+    inline explicit dispatchGuard(const sourceLoc& loc);
+    inline ~dispatchGuard();
+};
+
+dispatchGuard::dispatchGuard(const sourceLoc& loc): previous(dispatchLoc()){
+    dispatchLoc() = &loc;
+}
+
+dispatchGuard::~dispatchGuard(){
+    dispatchLoc() = previous;
+}
+
+template<>
+inline const llfmt& defaultFormat<llfmt>(){
+    static const llfmt ret = llfmt(
+            llfmt() << "[" << llfmt::time  << "] "
+                    << llfmt::level << ": "
+                    << llfmt::logStr
+    );
+    return ret;
+}
+
+// Encoding of the message and kv fields, only llfmt chooses one
+template<typename F>
+inline kvEncoding formatEncoding(const F&){
+    return plain;
+}
+
+inline kvEncoding formatEncoding(const llfmt& format){
+    return format.encoding();
+}
+
+// Format used by llogger<B, F> when none is given, which backends
+// rendering their own format can override
+template<typename B, typename F>
+struct backendFormat{
+    inline static const F& get(){
+        return defaultFormat<F>();
+    }
+};
+
+// Enabled level of the unnamed llogger<B, F>, which backends deriving it
+// from levels of their own can keep up to date until detach
+template<typename B>
+struct backendLevel{
+    inline static void attach(B&, std::atomic<level>*){
+    }
+    inline static void detach(B&, std::atomic<level>*){
+    }
+};
+
+} // namespace detail
+
+template<typename B = OStreamSync, typename F = llfmt>
 class llogger{
   public:
-    llogger(level lev, B& backend = defaultBackend(), const llfmt& format = defaultFmt());
-    llogger(const llogger<B>& other);
+    llogger(level lev, B& backend = defaultBackend(), const F& format = defaultFmt());
+    // Logger named in the hierarchy of Registry::global(), which sets its
+    // level
+    llogger(const std::string& name, B& backend = defaultBackend(), const F& format = defaultFmt());
+    llogger(const llogger<B, F>& other);
+    ~llogger();
+
+    // The enabled level can be changed while other threads log. For a
+    // named logger, this sets the level of its name in the registry.
+    inline void setLevel(level lev);
+    inline level getLevel() const;
+
+    // Keep the last lines messages at lev or more severe that the enabled
+    // level filters out, per thread, and write them before the next error
+    // or fatal message of the same thread. 0 lines turns it off.
+    inline void setBacktrace(size_t lines, level lev = debug);
 
   private:
-    template<typename>
+    template<typename, typename>
     friend class detail::logger;
 
-    template <typename T>
-    using isRetNonVoid =  typename std::enable_if<
-        !std::is_same<void, detail::invokeResult<T> >::value, bool
-    >::type;
-    
-    template<typename T, typename B_, typename llogger<B_>::template isRetNonVoid<T> >
-    friend detail::logger<B_>&& operator << (detail::logger<B_>&& wrap, const T& content);
-    template<typename T, typename B_, typename std::enable_if<!detail::isCallable<T>::value, bool>::type>
-    friend detail::logger<B_>&& operator << (detail::logger<B_>&& wrap, const T& content);
-
-    const llfmt& fmt;
+    const F& fmt;
     B& backend_;
-    level level_;
-    level curLev;
-
-    static const llfmt& defaultFmt();
+    std::atomic<level> level_;
+    // Key of the level of the previous message, which is kept per thread
+    const unsigned long long uid_;
+    const std::string name_;
+    const bool named_;
+    // Counters of backend_ in the self-metrics
+    const size_t metricsId_;
+    // Least severe level kept by the backtrace rings, silent when off
+    std::atomic<level> traceLevel_;
+    std::atomic<size_t> traceLines_;
+
+    static const F& defaultFmt();
     static OStreamSync& defaultBackend();
+    static unsigned long long nextUid();
+
+    inline bool capture(level lev) const;
 
   public:
-    inline detail::logger<B> operator() ();
-    inline detail::logger<B> operator() (level lev);
-    inline detail::logger<B> operator() (bool predicate);
-    inline detail::logger<B> operator() (level lev, bool predicate);
+    // The call site is passed by default for llfmt::source
+    inline detail::logger<B, F> operator() (sourceLoc loc = sourceLoc::current());
+    inline detail::logger<B, F> operator() (level lev, sourceLoc loc = sourceLoc::current());
+    inline detail::logger<B, F> operator() (bool predicate, sourceLoc loc = sourceLoc::current());
+    inline detail::logger<B, F> operator() (level lev, bool predicate, sourceLoc loc = sourceLoc::current());
+    inline detail::logger<B, F> operator() (passed predicate, sourceLoc loc = sourceLoc::current());
+    inline detail::logger<B, F> operator() (level lev, passed predicate, sourceLoc loc = sourceLoc::current());
 
     template<typename T = std::chrono::microseconds>
     static inline long long tElapsed(const std::chrono::steady_clock::time_point& start);
 };
 
-template<typename B>
-const llfmt& llogger<B>::defaultFmt(){
-    static const llfmt ret = llfmt(
-            llfmt() << "[" << llfmt::time  << "] "
-                    << llfmt::level << ": "
-                    << llfmt::logStr
-    );
-    return ret;
+template<typename B, typename F>
+const F& llogger<B, F>::defaultFmt(){
+    return detail::backendFormat<B, F>::get();
 }
 
-template<typename B>
-OStreamSync& llogger<B>::defaultBackend(){
+template<typename B, typename F>
+OStreamSync& llogger<B, F>::defaultBackend(){
     static OStreamSync ret(std::cout);
     return ret;
 }
 
-template<typename B>
-llogger<B>::llogger(level lev, B& backend, const llfmt& format): backend_(backend),
+template<typename B, typename F>
+unsigned long long llogger<B, F>::nextUid(){
+    static std::atomic<unsigned long long> uid(0);
+    return ++uid;
+}
+
+template<typename B, typename F>
+llogger<B, F>::llogger(level lev, B& backend, const F& format): fmt(format),
+                                                                backend_(backend),
                                                                 level_(lev),
-                                                                curLev(info),
-                                                                fmt(format){
+                                                                uid_(nextUid()),
+                                                                named_(false),
+                                                                metricsId_(metricsEnabled ? Metrics::global().backendId(&backend) : 0),
+                                                                traceLevel_(silent),
+                                                                traceLines_(0){
+    detail::liveUids::global().add(uid_);
+    detail::backendLevel<B>::attach(backend_, &level_);
 };
 
-template<typename B>
-llogger<B>::llogger(const llogger& other): backend_(other.backend_),
-                                        level_(other.level_),
-                                        curLev(info),
-                                        fmt(other.fmt){
+template<typename B, typename F>
+llogger<B, F>::llogger(const std::string& name, B& backend, const F& format): fmt(format),
+                                                                              backend_(backend),
+                                                                              level_(info),
+                                                                              uid_(nextUid()),
+                                                                              name_(name),
+                                                                              named_(true),
+                                                                              metricsId_(metricsEnabled ?
+                                                                                  Metrics::global().backendId(&backend) : 0),
+                                                                              traceLevel_(silent),
+                                                                              traceLines_(0){
+    detail::liveUids::global().add(uid_);
+    Registry::global().attach(name_, &level_);
 }
 
+template<typename B, typename F>
+llogger<B, F>::llogger(const llogger& other): fmt(other.fmt),
+                                              backend_(other.backend_),
+                                              level_(other.getLevel()),
+                                              uid_(nextUid()),
+                                              name_(other.name_),
+                                              named_(other.named_),
+                                              metricsId_(other.metricsId_),
+                                              traceLevel_(other.traceLevel_.load(std::memory_order_relaxed)),
+                                              traceLines_(other.traceLines_.load(std::memory_order_relaxed)){
+    detail::liveUids::global().add(uid_);
+    if(named_){
+        Registry::global().attach(name_, &level_);
+    }else{
+        detail::backendLevel<B>::attach(backend_, &level_);
+    }
+}
 
-template<typename B>
-detail::logger<B> llogger<B>::operator() (){
-    bool enable = curLev <= level_;
-    return detail::logger<B>(*this, enable, curLev, fmt.getIters());
+template<typename B, typename F>
+llogger<B, F>::~llogger(){
+    if(named_){
+        Registry::global().detach(name_, &level_);
+    }else{
+        detail::backendLevel<B>::detach(backend_, &level_);
+    }
+    detail::liveUids::global().remove(uid_);
 }
 
-template<typename B>
-detail::logger<B> llogger<B>::operator() (level lev){
-    curLev = lev;
-    bool enable = curLev <= level_;
-    return detail::logger<B>(*this, enable, curLev, fmt.getIters());
+template<typename B, typename F>
+void llogger<B, F>::setLevel(level lev){
+    if(named_){
+        Registry::global().setLevel(name_, lev);
+    }else{
+        level_.store(lev, std::memory_order_relaxed);
+    }
 }
 
-template<typename B>
-detail::logger<B> llogger<B>::operator() (bool predicate){
-    bool enable = curLev <= level_ && predicate;
-    return detail::logger<B>(*this, enable, curLev, fmt.getIters());
+template<typename B, typename F>
+level llogger<B, F>::getLevel() const{
+    return level_.load(std::memory_order_relaxed);
 }
 
-template<typename B>
-detail::logger<B> llogger<B>::operator() (level lev, bool predicate){
-    curLev = lev;
-    bool enable = curLev <= level_ && predicate;
-    return detail::logger<B>(*this, enable, curLev, fmt.getIters());
+template<typename B, typename F>
+void llogger<B, F>::setBacktrace(size_t lines, level lev){
+    traceLines_.store(lines, std::memory_order_relaxed);
+    traceLevel_.store(lines != 0 ? lev : silent, std::memory_order_relaxed);
 }
 
-template<typename B>
+template<typename B, typename F>
+bool llogger<B, F>::capture(level lev) const{
+    return lev <= traceLevel_.load(std::memory_order_relaxed);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (sourceLoc loc){
+    level curLev = detail::stickyLevel(uid_);
+    if(curLev > minLevel){
+        return detail::logger<B, F>(*this, false, curLev);
+    }
+    bool enable = curLev <= getLevel();
+    return detail::logger<B, F>(*this, enable, curLev, 0, !enable && capture(curLev), loc);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (level lev, sourceLoc loc){
+    detail::stickyLevel(uid_) = lev;
+    // Stripped at compile time: nothing but the sticky level is touched
+    if(lev > minLevel){
+        return detail::logger<B, F>(*this, false, lev);
+    }
+    bool enable = lev <= getLevel();
+    return detail::logger<B, F>(*this, enable, lev, 0, !enable && capture(lev), loc);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (bool predicate, sourceLoc loc){
+    level curLev = detail::stickyLevel(uid_);
+    if(curLev > minLevel){
+        return detail::logger<B, F>(*this, false, curLev);
+    }
+    bool enable = curLev <= getLevel() && predicate;
+    return detail::logger<B, F>(*this, enable, curLev, 0, !enable && predicate && capture(curLev), loc);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (level lev, bool predicate, sourceLoc loc){
+    detail::stickyLevel(uid_) = lev;
+    if(lev > minLevel){
+        return detail::logger<B, F>(*this, false, lev);
+    }
+    bool enable = lev <= getLevel() && predicate;
+    return detail::logger<B, F>(*this, enable, lev, 0, !enable && predicate && capture(lev), loc);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (passed predicate, sourceLoc loc){
+    level curLev = detail::stickyLevel(uid_);
+    if(curLev > minLevel){
+        return detail::logger<B, F>(*this, false, curLev);
+    }
+    bool enable = curLev <= getLevel() && predicate.pass;
+    return detail::logger<B, F>(*this, enable, curLev, predicate.pass ? predicate.suppressed : 0,
+                                !enable && predicate.pass && capture(curLev), loc);
+}
+
+template<typename B, typename F>
+detail::logger<B, F> llogger<B, F>::operator() (level lev, passed predicate, sourceLoc loc){
+    detail::stickyLevel(uid_) = lev;
+    if(lev > minLevel){
+        return detail::logger<B, F>(*this, false, lev);
+    }
+    bool enable = lev <= getLevel() && predicate.pass;
+    return detail::logger<B, F>(*this, enable, lev, predicate.pass ? predicate.suppressed : 0,
+                                !enable && predicate.pass && capture(lev), loc);
+}
+
+template<typename B, typename F>
 template<typename T>
-long long llogger<B>::tElapsed(const std::chrono::steady_clock::time_point& start){
+long long llogger<B, F>::tElapsed(const std::chrono::steady_clock::time_point& start){
     auto end = std::chrono::steady_clock::now();
     return std::chrono::duration_cast<T>(end - start).count();
 }
 
 namespace detail{
 
-template<typename B>
+template<typename B, typename F>
 struct logger{
-    inline logger(llogger<B>& holder, bool enable, level curLev, const fmtItrs& state);
-    inline logger(const logger<B>& other);
+    inline logger(llogger<B, F>& holder,
+                  bool enable,
+                  level curLev,
+                  unsigned long long suppressed = 0,
+                  bool capture = false,
+                  const sourceLoc& loc = sourceLoc{"", 0});
+    inline logger(const logger<B, F>& other);
 
     template <typename BS = B, typename std::enable_if<
         isCallable<decltype(&BS::log), BS&, const std::string&>::value, bool>::type = true>
@@ -278,118 +620,500 @@ struct logger{
         isCallable<decltype(&BS::log), BS&, const std::string&, level>::value, bool>::type = true>
     inline void dtorImpl();
     inline ~logger();
+    // Setup and dispatch of an enabled message, kept out of the
+    // constructor and destructor so that disabled ones stay small
+    inline void start();
+    inline void finish();
 
     inline void putFmtStr();
-
-    llogger<B>& holder_;
-    std::ostringstream buf_;
+    template<typename T>
+    inline void put(const T& value);
+    template<typename T>
+    inline void putKv(const kvPair<T>& field);
+    template<typename T>
+    inline void putKvValue(const T& value);
+    inline void putKvValue(bool value);
+    // Stream writing into buf_, for types without a dedicated formatter
+    inline std::ostream& stream();
+    inline void syncStream();
+
+    llogger<B, F>& holder_;
+    msgBuf buf_;
+    bufStream* stream_;
+    std::unique_ptr<bufStream> ownStream_;
+    fmtSpec spec_;
+    // Set while manipulators left the stream in a non-default state, in
+    // which case every value goes through the stream
+    bool streamFmt_;
     bool enable_;
+    // Assembled for the backtrace ring rather than the backend
+    bool capture_;
     level curLev_;
-    fmtItrs state_;
+    // Messages dropped by a rate limiting predicate before this one
+    unsigned long long suppressed_;
+    typename F::state state_;
+    kvEncoding encoding_;
+    // Where the message text starts in buf_
+    size_t msgStart_;
+    // Encoded kv fields of JSON and logfmt lines, which follow the text
+    kvFields* fields_;
+    std::unique_ptr<kvFields> ownFields_;
+    // Monotonic time of the call when Metrics times messages, or 0
+    long long startNs_;
+    sourceLoc loc_;
 
     inline void putFmtStr(fmtItrs& state);
     inline void timeStamp(fmtItrs& state);
+    inline void timeStampMs(fmtItrs& state);
+    inline void timeStampUs(fmtItrs& state);
+    inline void timeStampNs(fmtItrs& state);
+    inline void putTime(int digits);
+    inline void putLevel();
     inline void putLogLev(fmtItrs& state);
     inline void putFmtLmb(fmtItrs& state);
+    inline void putFmtApp(fmtItrs& state);
+    inline void putSuppressed();
+    // Hand the line to the backend, updating the self-metrics
+    inline void countWritten();
+    // Write the lines kept by the backtrace ring of this thread
+    inline void writeBacktrace();
+    inline msgBuf& fields();
+    // Append a field whose value was rendered at buf_[mark, size) and
+    // drop the value from buf_
+    inline void putField(const char* key, size_t mark, bool quote);
+    inline void finishEncoded();
+
+    using streamTag = std::integral_constant<int, 0>;
+    using fastTag   = std::integral_constant<int, 1>;
+    using manipTag  = std::integral_constant<int, 2>;
+
+    template<typename T>
+    inline void putImpl(const T& value, streamTag);
+    template<typename T>
+    inline void putImpl(const T& value, fastTag);
+    template<typename T>
+    inline void putImpl(const T& value, manipTag);
 };
 
-template<typename B>
-logger<B>::logger(llogger<B>& holder, 
-                bool enable, 
-                level curLev, 
-                const fmtItrs& state):  
-                holder_(holder),
-                enable_(enable),
-                curLev_(curLev),
-                state_(state){
-    logger<B>::putFmtStr();
+template<typename B, typename F>
+logger<B, F>::logger(llogger<B, F>& holder,
+                     bool enable,
+                     level curLev,
+                     unsigned long long suppressed,
+                     bool capture,
+                     const sourceLoc& loc): holder_(holder),
+                                    stream_(nullptr),
+                                    streamFmt_(false),
+                                    enable_(enable || capture),
+                                    capture_(capture),
+                                    curLev_(curLev),
+                                    suppressed_(suppressed),
+                                    state_(),
+                                    encoding_(plain),
+                                    msgStart_(0),
+                                    fields_(nullptr),
+                                    startNs_(0),
+                                    loc_(loc){
+    // A disabled message touches nothing but enable_ from here on
+    if(enable_){
+        start();
+    }
+    if(metricsEnabled && !enable && curLev_ <= minLevel && curLev_ > silent){
+        // Levels stripped at compile time are not counted
+        threadMetrics::local().filtered[static_cast<size_t>(curLev_)].add(1);
+    }
 }
 
-template<typename B>
-logger<B>::logger(const logger<B>& other):  holder_(other.holder_),
+template<typename B, typename F>
+logger<B, F>::logger(const logger<B, F>& other):  holder_(other.holder_),
+                                            buf_(other.buf_),
+                                            stream_(nullptr),
+                                            spec_(other.spec_),
+                                            streamFmt_(false),
+                                            enable_(other.enable_),
+                                            capture_(other.capture_),
                                             curLev_(other.curLev_),
-                                            state_(other.state_){
+                                            suppressed_(other.suppressed_),
+                                            state_(other.state_),
+                                            encoding_(other.encoding_),
+                                            msgStart_(other.msgStart_),
+                                            fields_(nullptr),
+                                            startNs_(other.startNs_),
+                                            loc_(other.loc_){
+    if(other.fields_ != nullptr){
+        fields().append(other.fields_->buf.data(), other.fields_->buf.size());
+    }
 }
 
 
-template<typename B>
+template<typename B, typename F>
 template <typename BS, typename std::enable_if<
     isCallable<decltype(&BS::log), BS&, const std::string&>::value, bool>::type>
-void logger<B>::dtorImpl(){
+void logger<B, F>::dtorImpl(){
+    dispatchGuard guard(loc_);
     holder_.backend_.log(buf_.str());
 }
 
-template<typename B>
+template<typename B, typename F>
 template <typename BS, typename std::enable_if<
     isCallable<decltype(&BS::log), BS&, const std::string&, level>::value, bool>::type>
-void logger<B>::dtorImpl(){
+void logger<B, F>::dtorImpl(){
+    dispatchGuard guard(loc_);
     holder_.backend_.log(buf_.str(), curLev_);
 }
 
-template<typename B>
-logger<B>::~logger(){
+template<typename B, typename F>
+logger<B, F>::~logger(){
     if(enable_){
+        finish();
+    }
+}
+
+template<typename B, typename F>
+void logger<B, F>::start(){
+    if(metricsEnabled && Metrics::timing()){
+        startNs_ = monotonicNs();
+    }
+    buf_.useThreadLine();
+    encoding_ = formatEncoding(holder_.fmt);
+    state_ = holder_.fmt.getIters();
+    putFmtStr();
+    if(encoding_ == json){
+        buf_.append("\"msg\":\"", 7);
+    }else if(encoding_ == logfmt){
+        buf_.append("msg=\"", 5);
+    }
+    msgStart_ = buf_.size();
+}
+
+template<typename B, typename F>
+void logger<B, F>::finish(){
+    if(stream_ != nullptr && stream_ != ownStream_.get()){
+        stream_->release();
+    }
+    if(suppressed_ != 0){
+        putSuppressed();
+    }
+    if(encoding_ != plain){
+        finishEncoded();
+    }
+    if(capture_){
+        backtraceRing::of(holder_.uid_).push(buf_.data(), buf_.size(), curLev_,
+                                             holder_.traceLines_.load(std::memory_order_relaxed));
+    }else{
+        if(curLev_ <= error && holder_.traceLevel_.load(std::memory_order_relaxed) != silent){
+            writeBacktrace();
+        }
+        if(metricsEnabled){
+            countWritten();
+        }else{
+            dtorImpl();
+        }
+    }
+    if(fields_ != nullptr && fields_ != ownFields_.get()){
+        fields_->busy = false;
+    }
+}
+
+template<typename B, typename F>
+void logger<B, F>::writeBacktrace(){
+    B& backend = holder_.backend_;
+    backtraceRing::of(holder_.uid_).drain([&backend](const std::string& line, level lev){
+        backendLog(backend, line, lev);
+    });
+}
+
+template<typename B, typename F>
+void logger<B, F>::countWritten(){
+    threadMetrics& metrics = threadMetrics::local();
+    threadMetrics::backend& backend = metrics.backends[holder_.metricsId_];
+    if(curLev_ > silent){
+        metrics.written[static_cast<size_t>(curLev_)].add(1);
+        metrics.bytes[static_cast<size_t>(curLev_)].add(buf_.size());
+    }
+    backend.lines.add(1);
+    backend.bytes.add(buf_.size());
+
+    if(startNs_ == 0){
         dtorImpl();
+        return;
     }
+    const long long assembled = monotonicNs();
+    metrics.assembly.record(assembled - startNs_);
+    dtorImpl();
+    backend.latency.record(monotonicNs() - assembled);
 }
 
-template<typename B>
-void logger<B>::putFmtStr(fmtItrs& state){
-    buf_ << *(state.fmtStrIter++);
+template<typename B, typename F>
+std::ostream& logger<B, F>::stream(){
+    if(stream_ == nullptr){
+        stream_ = &bufStream::local();
+        // An operator << of a logged value may itself log on this thread
+        if(stream_->busy){
+            ownStream_.reset(new bufStream);
+            stream_ = ownStream_.get();
+        }
+        stream_->busy = true;
+    }
+    // Bytes may have been appended to buf_ since the last use
+    stream_->sb.attach(buf_);
+    return stream_->os;
 }
 
-template<typename B>
-void logger<B>::timeStamp(fmtItrs& state){
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_time = std::chrono::system_clock::to_time_t(now);
-    buf_ << std::put_time(std::localtime(&now_time), " %Y-%m-%d %X ");
+template<typename B, typename F>
+void logger<B, F>::syncStream(){
+    stream_->sb.publish();
 }
 
-template<typename B>
-void logger<B>::putLogLev(fmtItrs& state){
-    buf_ << holder_.fmt.levelNames_[static_cast<size_t>(curLev_)];
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::put(const T& value){
+    putImpl(value, std::integral_constant<int,
+        isManip<typename std::decay<T>::type>::value ? 2 : hasFastFmt<T>::value ? 1 : 0>());
 }
 
-template<typename B>
-void logger<B>::putFmtLmb(fmtItrs& state){
-    buf_ << (*(state.fmtLmbIter++))();
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::putKv(const kvPair<T>& field){
+    if(encoding_ != plain){
+        const size_t mark = buf_.size();
+        putKvValue(field.value);
+        putField(field.key, mark, !kvIsBare<T>::value || !kvFinite(field.value));
+        return;
+    }
+
+    // Inline as key=value, separated from the text before it
+    if(buf_.size() > msgStart_ && buf_.data()[buf_.size() - 1] != ' '){
+        buf_.push_back(' ');
+    }
+    logfmtKey(buf_, field.key, field.key + std::strlen(field.key));
+    buf_.push_back('=');
+    const size_t mark = buf_.size();
+    putKvValue(field.value);
+    if(logfmtQuote(buf_.data() + mark, buf_.data() + buf_.size())){
+        msgBuf& scratch = fields();
+        const size_t from = scratch.size();
+        scratch.append(buf_.data() + mark, buf_.size() - mark);
+        buf_.resize(mark);
+        buf_.push_back('"');
+        escapeTo(buf_, scratch.data() + from, scratch.data() + scratch.size(), logfmt);
+        buf_.push_back('"');
+        scratch.resize(from);
+    }
 }
 
-template<typename B>
-void logger<B>::putFmtStr(){
-    static const std::array<void (logger<B>::*)(fmtItrs& state), 4> fmtCbs{
-        &logger::putFmtStr, 
-        &logger::putLogLev, 
-        &logger::timeStamp, 
-        &logger::putFmtLmb
-    };
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::putKvValue(const T& value){
+    put(value);
+}
 
-    if(enable_){
-        for(size_t i: holder_.fmt.fmtOpt(state_)){
-            (this->*(fmtCbs[i]))(state_);
+template<typename B, typename F>
+void logger<B, F>::putKvValue(bool value){
+    buf_.append(value ? "true" : "false", value ? 4 : 5);
+}
+
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::putImpl(const T& value, manipTag){
+    fmtValue(buf_, value, spec_);
+}
+
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::putImpl(const T& value, fastTag){
+    if(!streamFmt_){
+        fmtValue(buf_, value, spec_);
+    }else{
+        putImpl(value, streamTag());
+    }
+}
+
+template<typename B, typename F>
+template<typename T>
+void logger<B, F>::putImpl(const T& value, streamTag){
+    std::ostream& os = stream();
+    if(spec_.width > 0){
+        const char fill = os.fill(spec_.fill);
+        os.width(spec_.width);
+        os << value;
+        os.fill(fill);
+        spec_.width = 0;
+    }else{
+        os << value;
+    }
+    syncStream();
+
+    streamFmt_ = os.flags() != (std::ios_base::skipws | std::ios_base::dec) ||
+                 os.precision() != 6 || os.width() != 0 || os.fill() != ' ';
+}
+
+template<typename B, typename F>
+void logger<B, F>::putFmtStr(fmtItrs& state){
+    buf_.append(*(state.fmtStrIter++));
+}
+
+template<typename B, typename F>
+void logger<B, F>::timeStamp(fmtItrs&){
+    putTime(0);
+}
+
+template<typename B, typename F>
+void logger<B, F>::timeStampMs(fmtItrs&){
+    putTime(3);
+}
+
+template<typename B, typename F>
+void logger<B, F>::timeStampUs(fmtItrs&){
+    putTime(6);
+}
+
+template<typename B, typename F>
+void logger<B, F>::timeStampNs(fmtItrs&){
+    putTime(9);
+}
+
+template<typename B, typename F>
+void logger<B, F>::putTime(int digits){
+    char text[48];
+    size_t len = renderTime(text, clockNs(holder_.fmt.clock_), digits);
+    if(encoding_ == plain){
+        buf_.append(text, len);
+    }else{
+        // yyyy-mm-ddThh:mm:ss[.fraction] without padding
+        text[11] = 'T';
+        buf_.append(text + 1, len - 2);
+    }
+}
+
+template<typename B, typename F>
+void logger<B, F>::putLevel(){
+    const char* name = holder_.fmt.levelNames_[static_cast<size_t>(curLev_)];
+    buf_.append(name, std::strlen(name));
+}
+
+template<typename B, typename F>
+void logger<B, F>::putLogLev(fmtItrs&){
+    putLevel();
+}
+
+template<typename B, typename F>
+void logger<B, F>::putFmtLmb(fmtItrs& state){
+    buf_.append((*(state.fmtLmbIter++))());
+}
+
+template<typename B, typename F>
+void logger<B, F>::putFmtApp(fmtItrs& state){
+    fmtWriter writer(buf_, loc_);
+    (*(state.fmtAppIter++))(writer);
+}
+
+template<typename B, typename F>
+void logger<B, F>::putSuppressed(){
+    fmtSpec spec;
+    if(encoding_ != plain){
+        const size_t mark = buf_.size();
+        fmtValue(buf_, suppressed_, spec);
+        putField("suppressed", mark, false);
+        return;
+    }
+    buf_.append(" [", 2);
+    fmtValue(buf_, suppressed_, spec);
+    if(suppressed_ == 1){
+        buf_.append(" message suppressed]", 20);
+    }else{
+        buf_.append(" messages suppressed]", 21);
+    }
+}
+
+template<typename B, typename F>
+msgBuf& logger<B, F>::fields(){
+    if(fields_ == nullptr){
+        fields_ = &kvFields::local();
+        // An operator << of a logged value may itself log on this thread
+        if(fields_->busy){
+            ownFields_.reset(new kvFields);
+            fields_ = ownFields_.get();
         }
+        fields_->busy = true;
+        fields_->buf.clear();
     }
+    return fields_->buf;
 }
 
-template<typename B>
-logger<B>&& operator << (logger<B>&& wrap, fmtStrType){
-    wrap.putFmtStr();
+template<typename B, typename F>
+void logger<B, F>::putField(const char* key, size_t mark, bool quote){
+    msgBuf& out = fields();
+    const char* value = buf_.data() + mark;
+    const char* end = buf_.data() + buf_.size();
+    const size_t keyLen = std::strlen(key);
+    if(encoding_ == json){
+        out.append(",\"", 2);
+        escapeTo(out, key, key + keyLen, json);
+        out.append("\":", 2);
+    }else{
+        out.push_back(' ');
+        logfmtKey(out, key, key + keyLen);
+        out.push_back('=');
+        quote = logfmtQuote(value, end);
+    }
+
+    if(quote){
+        out.push_back('"');
+        escapeTo(out, value, end, encoding_);
+        out.push_back('"');
+    }else{
+        out.append(value, static_cast<size_t>(end - value));
+    }
+    buf_.resize(mark);
+}
+
+template<typename B, typename F>
+void logger<B, F>::finishEncoded(){
+    escapeTail(buf_, msgStart_, fields(), encoding_);
+    buf_.push_back('"');
+    buf_.append(fields_->buf.data(), fields_->buf.size());
+    // The rest of the format follows the fields
+    putFmtStr();
+}
+
+template<typename B, typename F>
+void logger<B, F>::putFmtStr(){
+    if(enable_){
+        holder_.fmt.render(*this, state_);
+    }
+}
+
+template<typename B, typename F>
+logger<B, F>&& operator << (logger<B, F>&& wrap, fmtStrType){
+    // JSON and logfmt lines render the rest of the format after the fields
+    if(wrap.encoding_ == plain){
+        wrap.putFmtStr();
+    }
     return std::move(wrap);
 }
 
-template<typename T, typename B, typename llogger<B>::template isRetNonVoid<T> = true>
-logger<B>&& operator << (logger<B>&& wrap, const T& content){
+template<typename T, typename B, typename F, isRetNonVoid<T> = true>
+logger<B, F>&& operator << (logger<B, F>&& wrap, const T& content){
     if(wrap.enable_){
-        wrap.buf_ << content();
+        wrap.put(content());
     }
     return std::move(wrap); 
 }
 
-template<typename T, typename B,
-    typename std::enable_if<!isCallable<T>::value, bool>::type = true>
-logger<B>&& operator << (logger<B>&& wrap, const T& content){
+template<typename T, typename B, typename F>
+logger<B, F>&& operator << (logger<B, F>&& wrap, const kvPair<T>& field){
+    if(wrap.enable_){
+        wrap.putKv(field);
+    }
+    return std::move(wrap);
+}
+
+template<typename T, typename B, typename F,
+    typename std::enable_if<!isCallable<T>::value && !isKv<T>::value, bool>::type = true>
+logger<B, F>&& operator << (logger<B, F>&& wrap, const T& content){
     if(wrap.enable_){
-        wrap.buf_ << content;
+        wrap.put(content);
     }
     return std::move(wrap);
 }
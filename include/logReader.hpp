@@ -0,0 +1,504 @@
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kv.hpp"
+#include "llogger.h"
+
+namespace ll{
+
+// Entry of the sparse index of a text log: a chunk of whole lines starting
+// at offset and ending where the next chunk starts, and the earliest and
+// latest time of its lines in ns since epoch
+struct lineChunk{
+    int64_t minNs;
+    int64_t maxNs;
+    uint64_t offset;
+};
+
+static_assert(sizeof(lineChunk) == 24, "index entries must stay 24 bytes");
+
+namespace detail{
+
+// First '\n' in [p, end), or end. No byte is below SCHAR_MIN.
+inline const char* findNewline(const char* p, const char* end){
+    return findSpecial(p, end, static_cast<char>(SCHAR_MIN), '\n', '\n', '\n');
+}
+
+// Value of the n digits at p, or -1
+inline long long readDigits(const char* p, int n){
+    long long ret = 0;
+    for(int i = 0; i < n; ++i){
+        if(p[i] < '0' || p[i] > '9'){
+            return -1;
+        }
+        ret = ret * 10 + (p[i] - '0');
+    }
+    return ret;
+}
+
+} // namespace detail
+
+// Reads back the time and level at the start of lines rendered with an
+// llfmt: the segments before its first logStr are matched in order, static
+// text as is, levels against the level names of the format, escapes
+// included, and times as renderTime writes them. A callback segment is
+// skipped up to the static text following it, and ends the match if none
+// does.
+class lineParser{
+  public:
+    inline explicit lineParser(const llfmt& format);
+
+    // Set ns and lev from a line starting like the format and return true,
+    // or leave them for a line that does not, such as the continuation of
+    // a multi-line message
+    inline bool parse(const char* line, size_t len, long long& ns, level& lev);
+    // Whether the format renders a time before the message
+    inline bool hasTime() const;
+    // Changes with the layout the lines are parsed with
+    inline uint64_t signature() const;
+
+  private:
+    enum itemType: char{literal, levelItem, timeItem, skip};
+
+    struct item{
+        itemType type;
+        int digits;
+        std::string text;
+    };
+
+    std::vector<item> items_;
+    std::array<std::string, levels> names_;
+    // Times are padded with spaces in plain formats, and use a 'T' in
+    // JSON and logfmt ones
+    bool plain_;
+    bool hasTime_;
+    uint64_t signature_;
+
+    // Local time of the start of the last hour parsed
+    char hourKey_[13];
+    long long hourSec_;
+
+    inline bool parseTime(const char*& p, const char* end, int digits, long long& ns);
+};
+
+lineParser::lineParser(const llfmt& format): plain_(format.encoding() == plain),
+                                             hasTime_(false),
+                                             signature_(0xcbf29ce484222325ULL),
+                                             hourSec_(0){
+    std::memset(hourKey_, 0, sizeof(hourKey_));
+    for(size_t i = 0; i < names_.size(); ++i){
+        names_[i] = format.levelNames()[i];
+    }
+
+    size_t str = 0;
+    for(size_t ord: format.fmtOrds.front()){
+        switch(ord){
+            case 0:
+                items_.push_back(item{literal, 0, format.fmtStrs[str++]});
+                break;
+            case 1:
+                items_.push_back(item{levelItem, 0, std::string()});
+                break;
+            case 2:
+            case 4:
+            case 5:
+            case 6:
+                items_.push_back(item{timeItem, ord == 2 ? 0 : static_cast<int>(ord - 3) * 3, std::string()});
+                break;
+            default:
+                items_.push_back(item{skip, 0, std::string()});
+                break;
+        }
+    }
+
+    // A time after a callback that nothing follows cannot be found
+    for(size_t i = 0; i < items_.size(); ++i){
+        if(items_[i].type == timeItem){
+            hasTime_ = true;
+            break;
+        }
+        if(items_[i].type == skip && (i + 1 == items_.size() || items_[i + 1].type != literal)){
+            break;
+        }
+    }
+
+    // FNV-1a of the items and level names
+    auto mix = [this](const char* p, size_t len){
+        for(size_t i = 0; i < len; ++i){
+            signature_ = (signature_ ^ static_cast<unsigned char>(p[i])) * 0x100000001b3ULL;
+        }
+    };
+    for(const item& it: items_){
+        const char head[2] = {static_cast<char>(it.type), static_cast<char>(it.digits)};
+        mix(head, sizeof(head));
+        mix(it.text.data(), it.text.size() + 1);
+    }
+    for(const std::string& name: names_){
+        mix(name.data(), name.size() + 1);
+    }
+    mix(plain_ ? "p" : "t", 1);
+}
+
+bool lineParser::parse(const char* line, size_t len, long long& ns, level& lev){
+    const char* p = line;
+    const char* end = line + len;
+    long long lineNs = ns;
+    level lineLev = lev;
+
+    for(size_t i = 0; i < items_.size(); ++i){
+        const item& it = items_[i];
+        switch(it.type){
+            case literal:
+                if(static_cast<size_t>(end - p) < it.text.size() ||
+                   std::memcmp(p, it.text.data(), it.text.size()) != 0){
+                    return false;
+                }
+                p += it.text.size();
+                break;
+            case levelItem:{
+                size_t match = names_.size();
+                for(size_t l = 0; l < names_.size(); ++l){
+                    const std::string& name = names_[l];
+                    // Longest match, in case a name starts another
+                    if(static_cast<size_t>(end - p) >= name.size() && std::memcmp(p, name.data(), name.size()) == 0 &&
+                       (match == names_.size() || name.size() > names_[match].size())){
+                        match = l;
+                    }
+                }
+                if(match == names_.size()){
+                    return false;
+                }
+                lineLev = static_cast<level>(match);
+                p += names_[match].size();
+                break;
+            }
+            case timeItem:
+                if(!parseTime(p, end, it.digits, lineNs)){
+                    return false;
+                }
+                break;
+            case skip:
+                if(i + 1 < items_.size() && items_[i + 1].type == literal){
+                    const std::string& next = items_[i + 1].text;
+                    const char* hit = std::search(p, end, next.begin(), next.end());
+                    if(hit == end && !next.empty()){
+                        return false;
+                    }
+                    p = hit;
+                }else{
+                    // Nothing tells where the callback output ends
+                    i = items_.size();
+                }
+                break;
+        }
+    }
+
+    ns = lineNs;
+    lev = lineLev;
+    return true;
+}
+
+bool lineParser::hasTime() const{
+    return hasTime_;
+}
+
+uint64_t lineParser::signature() const{
+    return signature_;
+}
+
+bool lineParser::parseTime(const char*& p, const char* end, int digits, long long& ns){
+    // [ ]yyyy-mm-dd[ T]hh:mm:ss[.fraction][ ]
+    const size_t pad = plain_ ? 1 : 0;
+    const size_t len = pad * 2 + 19 + (digits > 0 ? static_cast<size_t>(digits) + 1 : 0);
+    if(static_cast<size_t>(end - p) < len){
+        return false;
+    }
+    const char* t = p + pad;
+    if((plain_ && (p[0] != ' ' || p[len - 1] != ' ')) || t[4] != '-' || t[7] != '-' ||
+       t[10] != (plain_ ? ' ' : 'T') || t[13] != ':' || t[16] != ':' || (digits > 0 && t[19] != '.')){
+        return false;
+    }
+
+    const long long minute = detail::readDigits(t + 14, 2);
+    const long long second = detail::readDigits(t + 17, 2);
+    const long long frac = digits > 0 ? detail::readDigits(t + 20, digits) : 0;
+    if(minute < 0 || second < 0 || frac < 0){
+        return false;
+    }
+
+    // mktime only runs when the hour changes
+    if(std::memcmp(hourKey_, t, sizeof(hourKey_)) != 0){
+        const long long year = detail::readDigits(t, 4);
+        const long long month = detail::readDigits(t + 5, 2);
+        const long long day = detail::readDigits(t + 8, 2);
+        const long long hour = detail::readDigits(t + 11, 2);
+        if(year < 0 || month < 0 || day < 0 || hour < 0){
+            return false;
+        }
+        std::tm tm;
+        std::memset(&tm, 0, sizeof(tm));
+        tm.tm_year = static_cast<int>(year - 1900);
+        tm.tm_mon = static_cast<int>(month - 1);
+        tm.tm_mday = static_cast<int>(day);
+        tm.tm_hour = static_cast<int>(hour);
+        tm.tm_isdst = -1;
+        hourSec_ = static_cast<long long>(std::mktime(&tm));
+        std::memcpy(hourKey_, t, sizeof(hourKey_));
+    }
+
+    long long scale = 1;
+    for(int i = digits; i < 9; ++i){
+        scale *= 10;
+    }
+    ns = (hourSec_ + minute * 60 + second) * 1000000000LL + frac * scale;
+    p += len;
+    return true;
+}
+
+// Answers time range queries over a text log written with a llfmt. The
+// file is memory-mapped, and a sparse index holding the time span of each
+// chunk of about chunkBytes is kept in <path>.lidx. Opening a file indexes
+// the lines appended since the index was written, and writes it back.
+//
+// Lines are expected roughly in time order, as threads logging at once
+// produce them: a query binary searches the chunks for the first one that
+// may hold a line in range, then reads chunks until the remaining ones all
+// start after it.
+class LogReader{
+  public:
+    inline explicit LogReader(const std::string& path,
+                              const llfmt& format = detail::defaultFormat<llfmt>(),
+                              size_t chunkBytes = 1 << 16);
+    LogReader(const LogReader&) = delete;
+    inline ~LogReader();
+
+    // False if the file cannot be read or the format renders no time
+    inline bool good() const;
+    inline const std::vector<lineChunk>& chunks() const;
+
+    // Call f(const char* line, size_t len, long long ns, level lev) for
+    // each line with a time in [fromNs, toNs] and a level of maxLev or more
+    // severe, in file order. Lines not starting like the format, such as
+    // the continuations of multi-line messages, have the time and level
+    // of the line before them. Returns the number of lines passed to f.
+    template<typename F>
+    inline size_t forEach(long long fromNs, long long toNs, level maxLev, F&& f);
+
+  private:
+    struct indexHeader{
+        char magic[8];
+        uint64_t signature;
+        // Bytes indexed, ending with a newline, and the time and level of
+        // the last line indexed
+        uint64_t end;
+        int64_t lastNs;
+        int64_t lastLev;
+        uint64_t count;
+        // Start of the file, to notice it was replaced
+        char head[64];
+    };
+
+    static constexpr char indexMagic[8] = {'L', 'L', 'T', 'I', 'D', 'X', '\0', '\1'};
+
+    const std::string path_;
+    const size_t chunkBytes_;
+    lineParser parser_;
+    bool good_;
+    const char* data_;
+    size_t size_;
+    size_t end_;
+    long long lastNs_;
+    level lastLev_;
+    std::vector<lineChunk> chunks_;
+    // Latest time up to each chunk and earliest from it on, which stay
+    // sorted when lines are not
+    std::vector<int64_t> maxBefore_;
+    std::vector<int64_t> minAfter_;
+
+    inline bool loadIndex();
+    inline void index();
+    inline void saveIndex() const;
+};
+
+constexpr char LogReader::indexMagic[8];
+
+LogReader::LogReader(const std::string& path, const llfmt& format, size_t chunkBytes): path_(path),
+                                                                                       chunkBytes_(chunkBytes > 0 ? chunkBytes : 1),
+                                                                                       parser_(format),
+                                                                                       good_(false),
+                                                                                       data_(nullptr),
+                                                                                       size_(0),
+                                                                                       end_(0),
+                                                                                       lastNs_(INT64_MIN),
+                                                                                       lastLev_(info){
+    const int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        return;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void* map = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    good_ = parser_.hasTime() && (size_ == 0 || map != MAP_FAILED);
+    if(map == MAP_FAILED || !good_){
+        size_ = 0;
+        return;
+    }
+    data_ = static_cast<const char*>(map);
+
+    const bool loaded = loadIndex();
+    const size_t indexed = end_;
+    index();
+    if(!loaded || end_ != indexed){
+        saveIndex();
+    }
+
+    maxBefore_.resize(chunks_.size());
+    minAfter_.resize(chunks_.size());
+    for(size_t i = 0; i < chunks_.size(); ++i){
+        maxBefore_[i] = i == 0 ? chunks_[i].maxNs : std::max(maxBefore_[i - 1], chunks_[i].maxNs);
+    }
+    for(size_t i = chunks_.size(); i-- > 0;){
+        minAfter_[i] = i + 1 == chunks_.size() ? chunks_[i].minNs : std::min(minAfter_[i + 1], chunks_[i].minNs);
+    }
+}
+
+LogReader::~LogReader(){
+    if(data_ != nullptr){
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+bool LogReader::good() const{
+    return good_;
+}
+
+const std::vector<lineChunk>& LogReader::chunks() const{
+    return chunks_;
+}
+
+template<typename F>
+size_t LogReader::forEach(long long fromNs, long long toNs, level maxLev, F&& f){
+    const size_t first = static_cast<size_t>(std::lower_bound(maxBefore_.begin(), maxBefore_.end(), fromNs) -
+                                             maxBefore_.begin());
+    size_t ret = 0;
+    for(size_t i = first; i < chunks_.size() && minAfter_[i] <= toNs; ++i){
+        const char* p = data_ + chunks_[i].offset;
+        const char* end = data_ + (i + 1 < chunks_.size() ? chunks_[i + 1].offset : end_);
+        // A chunk starts with a line of its own time and level
+        long long ns = chunks_[i].minNs;
+        level lev = info;
+        while(p < end){
+            const char* nl = detail::findNewline(p, end);
+            const size_t len = static_cast<size_t>(nl - p);
+            parser_.parse(p, len, ns, lev);
+            if(ns >= fromNs && ns <= toNs && lev <= maxLev){
+                f(p, len, ns, lev);
+                ++ret;
+            }
+            p = nl + 1;
+        }
+    }
+    return ret;
+}
+
+bool LogReader::loadIndex(){
+    const int fd = ::open((path_ + ".lidx").c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    indexHeader header;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && read(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+              std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) == 0 &&
+              header.signature == parser_.signature() && header.end <= size_ &&
+              static_cast<uint64_t>(st.st_size) == sizeof(header) + header.count * sizeof(lineChunk) &&
+              std::memcmp(header.head, data_, std::min<size_t>(sizeof(header.head), header.end)) == 0;
+    if(ok){
+        chunks_.resize(static_cast<size_t>(header.count));
+        const ssize_t bytes = static_cast<ssize_t>(chunks_.size() * sizeof(lineChunk));
+        ok = chunks_.empty() || read(fd, chunks_.data(), static_cast<size_t>(bytes)) == bytes;
+    }
+    close(fd);
+
+    if(!ok || (header.end > 0 && data_[header.end - 1] != '\n')){
+        chunks_.clear();
+        return false;
+    }
+    end_ = static_cast<size_t>(header.end);
+    lastNs_ = header.lastNs;
+    lastLev_ = static_cast<level>(header.lastLev);
+    return true;
+}
+
+void LogReader::index(){
+    const char* p = data_ + end_;
+    const char* stop = data_ + size_;
+    while(p < stop){
+        const char* nl = detail::findNewline(p, stop);
+        // The last line is still being written
+        if(nl == stop){
+            break;
+        }
+        const uint64_t offset = static_cast<uint64_t>(p - data_);
+        const bool parsed = parser_.parse(p, static_cast<size_t>(nl - p), lastNs_, lastLev_);
+
+        // Chunks start with a line of their own, so that reading one needs
+        // nothing from the lines before it
+        if(parsed && (chunks_.empty() || offset - chunks_.back().offset >= chunkBytes_)){
+            chunks_.push_back(lineChunk{lastNs_, lastNs_, offset});
+        }else if(!chunks_.empty()){
+            lineChunk& c = chunks_.back();
+            c.minNs = std::min<int64_t>(c.minNs, lastNs_);
+            c.maxNs = std::max<int64_t>(c.maxNs, lastNs_);
+        }
+        p = nl + 1;
+    }
+    end_ = static_cast<size_t>(p - data_);
+}
+
+void LogReader::saveIndex() const{
+    indexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.signature = parser_.signature();
+    header.end = end_;
+    header.lastNs = lastNs_;
+    header.lastLev = lastLev_;
+    header.count = chunks_.size();
+    std::memcpy(header.head, data_, std::min(sizeof(header.head), end_));
+
+    // Readers of the index never see it half written
+    const std::string tmp = path_ + ".lidx.tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+        return;
+    }
+    const ssize_t bytes = static_cast<ssize_t>(chunks_.size() * sizeof(lineChunk));
+    const bool ok = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                    (chunks_.empty() || write(fd, chunks_.data(), static_cast<size_t>(bytes)) == bytes);
+    close(fd);
+    if(!ok || ::rename(tmp.c_str(), (path_ + ".lidx").c_str()) != 0){
+        ::unlink(tmp.c_str());
+    }
+}
+
+}
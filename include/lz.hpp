@@ -0,0 +1,203 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ll{
+
+namespace detail{
+
+// Byte-oriented LZ77 codec in the sequence layout of LZ4 blocks. Every
+// sequence is a token holding the literal length in its high nibble and
+// the match length minus 4 in its low nibble, with 255-byte extensions
+// for nibbles of 15, then the literals, then a 16-bit little-endian
+// offset. The last sequence has literals only.
+class lzCodec{
+  public:
+    // Compress src into out, returns the compressed size or 0 if it would
+    // not be smaller than the input
+    inline size_t compress(const char* src, size_t len, std::string& out);
+    // Returns false unless src decodes to exactly len bytes
+    inline static bool decompress(const char* src, size_t srcLen, char* dst, size_t len);
+
+  private:
+    static constexpr unsigned hashBits = 14;
+    static constexpr size_t minMatch = 4;
+    // Matches end at least this far from the end of the input, which is
+    // copied as literals
+    static constexpr size_t lastLiterals = 5;
+    static constexpr size_t matchLimit = 12;
+
+    std::vector<uint32_t> table_;
+
+    inline static uint32_t read32(const unsigned char* p);
+    inline static uint32_t hash(uint32_t seq);
+    inline static unsigned char* putLength(unsigned char* op, size_t len);
+};
+
+uint32_t lzCodec::read32(const unsigned char* p){
+    uint32_t ret;
+    std::memcpy(&ret, p, 4);
+    return ret;
+}
+
+uint32_t lzCodec::hash(uint32_t seq){
+    return (seq * 2654435761U) >> (32 - hashBits);
+}
+
+unsigned char* lzCodec::putLength(unsigned char* op, size_t len){
+    for(; len >= 255; len -= 255){
+        *op++ = 255;
+    }
+    *op++ = static_cast<unsigned char>(len);
+    return op;
+}
+
+size_t lzCodec::compress(const char* src, size_t len, std::string& out){
+    out.resize(len + len / 255 + 16);
+    table_.assign(size_t(1) << hashBits, 0);
+
+    const unsigned char* const base = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* const end = base + len;
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;
+    unsigned char* op = reinterpret_cast<unsigned char*>(&out[0]);
+
+    auto putSequence = [&op](const unsigned char* lit, size_t litLen, size_t offset, size_t matchLen){
+        unsigned char* token = op++;
+        *token = static_cast<unsigned char>(std::min<size_t>(litLen, 15) << 4);
+        if(litLen >= 15){
+            op = putLength(op, litLen - 15);
+        }
+        std::memcpy(op, lit, litLen);
+        op += litLen;
+        if(offset != 0){
+            *op++ = static_cast<unsigned char>(offset);
+            *op++ = static_cast<unsigned char>(offset >> 8);
+            *token |= static_cast<unsigned char>(std::min<size_t>(matchLen - minMatch, 15));
+            if(matchLen - minMatch >= 15){
+                op = putLength(op, matchLen - minMatch - 15);
+            }
+        }
+    };
+
+    if(len > matchLimit){
+        const unsigned char* const limit = end - matchLimit;
+        const unsigned char* const matchEnd = end - lastLiterals;
+        while(ip < limit){
+            const uint32_t seq = read32(ip);
+            uint32_t& slot = table_[hash(seq)];
+            const unsigned char* ref = base + slot;
+            slot = static_cast<uint32_t>(ip - base);
+            if(ref >= ip || ip - ref > 65535 || read32(ref) != seq){
+                // Skip faster through data that does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while(ip > anchor && ref > base && ip[-1] == ref[-1]){
+                --ip;
+                --ref;
+            }
+            const unsigned char* p = ip + minMatch;
+            const unsigned char* r = ref + minMatch;
+            while(p + 8 <= matchEnd){
+                uint64_t a, b;
+                std::memcpy(&a, p, 8);
+                std::memcpy(&b, r, 8);
+                if(a != b){
+                    break;
+                }
+                p += 8;
+                r += 8;
+            }
+            while(p < matchEnd && *p == *r){
+                ++p;
+                ++r;
+            }
+
+            putSequence(anchor, static_cast<size_t>(ip - anchor), static_cast<size_t>(ip - ref),
+                        static_cast<size_t>(p - ip));
+            ip = p;
+            anchor = p;
+            if(ip < limit){
+                table_[hash(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base);
+            }
+        }
+    }
+    putSequence(anchor, static_cast<size_t>(end - anchor), 0, 0);
+
+    const size_t ret = static_cast<size_t>(op - reinterpret_cast<unsigned char*>(&out[0]));
+    return ret < len ? ret : 0;
+}
+
+bool lzCodec::decompress(const char* src, size_t srcLen, char* dst, size_t len){
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* const iend = ip + srcLen;
+    unsigned char* const obase = reinterpret_cast<unsigned char*>(dst);
+    unsigned char* op = obase;
+    unsigned char* const oend = obase + len;
+
+    auto getLength = [&ip, iend](size_t& length){
+        unsigned char b;
+        do{
+            if(ip == iend){
+                return false;
+            }
+            b = *ip++;
+            length += b;
+        }while(b == 255);
+        return true;
+    };
+
+    while(ip < iend){
+        const unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if(lit == 15 && !getLength(lit)){
+            return false;
+        }
+        if(lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op)){
+            return false;
+        }
+        std::memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if(ip == iend){
+            break;
+        }
+
+        if(iend - ip < 2){
+            return false;
+        }
+        const size_t offset = static_cast<size_t>(ip[0]) | static_cast<size_t>(ip[1]) << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if(match == 15 && !getLength(match)){
+            return false;
+        }
+        match += minMatch;
+        if(offset == 0 || offset > static_cast<size_t>(op - obase) || match > static_cast<size_t>(oend - op)){
+            return false;
+        }
+
+        const unsigned char* ref = op - offset;
+        if(offset >= match){
+            std::memcpy(op, ref, match);
+        }else{
+            // Overlapping match repeating the last offset bytes
+            for(size_t i = 0; i < match; ++i){
+                op[i] = ref[i];
+            }
+        }
+        op += match;
+    }
+    return op == oend;
+}
+
+} // namespace detail
+
+}
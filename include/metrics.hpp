@@ -0,0 +1,573 @@
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lldefs.h"
+
+namespace ll{
+
+// Durations in power-of-two buckets: bucket i counts those below 2^i ns,
+// the last one every longer duration
+struct latencyHistogram{
+    static constexpr size_t buckets = 32;
+
+    std::array<unsigned long long, buckets> counts{};
+    unsigned long long sumNs = 0;
+
+    inline unsigned long long count() const;
+    // Upper bound of the bucket holding the q quantile, 0 when empty
+    inline unsigned long long quantileNs(double q) const;
+};
+
+// Counters of the logging pipeline since the start of the process
+struct metricsSnapshot{
+    struct backend{
+        std::string name;
+        unsigned long long lines = 0;
+        unsigned long long bytes = 0;
+        latencyHistogram latency;
+    };
+
+    struct queue{
+        std::string name;
+        size_t capacity = 0;
+        size_t highWater = 0;
+    };
+
+    // Records by level: every produced record is either filtered by the
+    // level or a predicate, or written to the backend of its llogger
+    std::array<unsigned long long, levels> produced{};
+    std::array<unsigned long long, levels> filtered{};
+    std::array<unsigned long long, levels> written{};
+    // Bytes of the written lines, without line terminators
+    std::array<unsigned long long, levels> bytes{};
+    // Lines an AsyncBackend lost to overflow
+    unsigned long long dropped = 0;
+    // Time from the llogger call to the backend, and spent in log() of
+    // each backend, recorded while Metrics::setTiming is on
+    latencyHistogram assembly;
+    std::vector<backend> backends;
+    std::vector<queue> queues;
+
+    // Prometheus text exposition format
+    inline std::string prometheus() const;
+};
+
+namespace detail{
+
+class queueGauge;
+struct threadMetrics;
+
+} // namespace detail
+
+// Registry of the counters kept by every logging thread, which are summed
+// when read. A thread adds to its own counters, so counting costs a
+// thread-local access and a few plain adds per message. The counters of
+// exited threads are added to running totals.
+class Metrics{
+  public:
+    inline static Metrics& global();
+
+    inline metricsSnapshot snapshot();
+
+    // Timing reads the monotonic clock three times per written message
+    inline void setTiming(bool on);
+    inline static bool timing();
+
+    // Label of a backend in snapshots, "backend0", "backend1"... by
+    // default in the order of their first llogger
+    inline void nameBackend(const void* backend, const std::string& name);
+    // Index of the counters of a backend, taken by llogger
+    inline size_t backendId(const void* backend);
+
+  private:
+    friend class detail::queueGauge;
+    friend struct detail::threadMetrics;
+
+    std::mutex mtx_;
+    // Blocks of counters, zeroed and reused by new threads once theirs
+    // exited and was added to retired_
+    std::deque<detail::threadMetrics> threads_;
+    std::unique_ptr<detail::threadMetrics> retired_;
+    // Counters of messages logged by thread_local destructors after the
+    // block of their thread was retired. Exiting threads share them, so
+    // concurrent adds may be lost.
+    std::unique_ptr<detail::threadMetrics> late_;
+    std::vector<std::pair<const void*, std::string> > backends_;
+    std::vector<const detail::queueGauge*> queues_;
+
+    inline Metrics();
+
+    inline detail::threadMetrics& acquire();
+    inline void release(detail::threadMetrics& block);
+    inline size_t findBackend(const void* backend);
+
+    inline static std::atomic<bool>& timingFlag();
+};
+
+namespace detail{
+
+// Counter written only by the thread owning its block and read by any,
+// so adds need no atomic read-modify-write
+class metricsCounter{
+  public:
+    inline void add(unsigned long long n);
+    inline unsigned long long get() const;
+    inline void reset();
+
+  private:
+    std::atomic<unsigned long long> value_{0};
+};
+
+void metricsCounter::add(unsigned long long n){
+    value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+unsigned long long metricsCounter::get() const{
+    return value_.load(std::memory_order_relaxed);
+}
+
+void metricsCounter::reset(){
+    value_.store(0, std::memory_order_relaxed);
+}
+
+class metricsHistogram{
+  public:
+    inline void record(long long ns);
+    inline void addTo(latencyHistogram& hist) const;
+    inline void addTo(metricsHistogram& hist) const;
+    inline void reset();
+
+  private:
+    metricsCounter counts_[latencyHistogram::buckets];
+    metricsCounter sumNs_;
+};
+
+void metricsHistogram::record(long long ns){
+    const unsigned long long value = ns > 0 ? static_cast<unsigned long long>(ns) : 0;
+    size_t bucket = bitLength(value);
+    if(bucket >= latencyHistogram::buckets){
+        bucket = latencyHistogram::buckets - 1;
+    }
+    counts_[bucket].add(1);
+    sumNs_.add(value);
+}
+
+void metricsHistogram::addTo(latencyHistogram& hist) const{
+    for(size_t i = 0; i < latencyHistogram::buckets; ++i){
+        hist.counts[i] += counts_[i].get();
+    }
+    hist.sumNs += sumNs_.get();
+}
+
+void metricsHistogram::addTo(metricsHistogram& hist) const{
+    for(size_t i = 0; i < latencyHistogram::buckets; ++i){
+        hist.counts_[i].add(counts_[i].get());
+    }
+    hist.sumNs_.add(sumNs_.get());
+}
+
+void metricsHistogram::reset(){
+    for(metricsCounter& count: counts_){
+        count.reset();
+    }
+    sumNs_.reset();
+}
+
+inline long long monotonicNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct threadMetrics{
+    // Backends past the last but one share the last counters
+    static constexpr size_t maxBackends = 16;
+
+    struct backend{
+        metricsCounter lines;
+        metricsCounter bytes;
+        metricsHistogram latency;
+    };
+
+    metricsCounter filtered[levels];
+    metricsCounter written[levels];
+    metricsCounter bytes[levels];
+    metricsCounter dropped;
+    metricsHistogram assembly;
+    backend backends[maxBackends];
+    // Owned by a running thread, guarded by the mutex of Metrics
+    bool used = false;
+
+    inline static threadMetrics& local();
+    // Block of the calling thread, nullptr before its first message
+    inline static threadMetrics*& current();
+
+    inline void addTo(threadMetrics& to) const;
+    inline void reset();
+};
+
+threadMetrics& threadMetrics::local(){
+    threadMetrics*& ret = current();
+    if(ret == nullptr){
+        ret = &Metrics::global().acquire();
+    }
+    return *ret;
+}
+
+threadMetrics*& threadMetrics::current(){
+    // A trivial thread_local is read without an initialization check
+    static thread_local threadMetrics* ret = nullptr;
+    return ret;
+}
+
+void threadMetrics::addTo(threadMetrics& to) const{
+    for(size_t i = 0; i < levels; ++i){
+        to.filtered[i].add(filtered[i].get());
+        to.written[i].add(written[i].get());
+        to.bytes[i].add(bytes[i].get());
+    }
+    to.dropped.add(dropped.get());
+    assembly.addTo(to.assembly);
+    for(size_t i = 0; i < maxBackends; ++i){
+        to.backends[i].lines.add(backends[i].lines.get());
+        to.backends[i].bytes.add(backends[i].bytes.get());
+        backends[i].latency.addTo(to.backends[i].latency);
+    }
+}
+
+void threadMetrics::reset(){
+    for(size_t i = 0; i < levels; ++i){
+        filtered[i].reset();
+        written[i].reset();
+        bytes[i].reset();
+    }
+    dropped.reset();
+    assembly.reset();
+    for(backend& b: backends){
+        b.lines.reset();
+        b.bytes.reset();
+        b.latency.reset();
+    }
+}
+
+// High watermark of the depth of a queue, listed in the snapshots while
+// the gauge exists
+class queueGauge{
+  public:
+    inline queueGauge(const std::string& name, size_t capacity);
+    queueGauge(const queueGauge&) = delete;
+    inline ~queueGauge();
+
+    inline void update(size_t depth);
+
+  private:
+    friend class ll::Metrics;
+
+    const std::string name_;
+    const size_t capacity_;
+    std::atomic<size_t> highWater_;
+};
+
+queueGauge::queueGauge(const std::string& name, size_t capacity): name_(name),
+                                                                   capacity_(capacity),
+                                                                   highWater_(0){
+    Metrics& metrics = Metrics::global();
+    std::lock_guard<std::mutex> lk(metrics.mtx_);
+    metrics.queues_.push_back(this);
+}
+
+queueGauge::~queueGauge(){
+    Metrics& metrics = Metrics::global();
+    std::lock_guard<std::mutex> lk(metrics.mtx_);
+    for(auto it = metrics.queues_.begin(); it != metrics.queues_.end(); ++it){
+        if(*it == this){
+            metrics.queues_.erase(it);
+            break;
+        }
+    }
+}
+
+void queueGauge::update(size_t depth){
+    size_t cur = highWater_.load(std::memory_order_relaxed);
+    while(depth > cur && !highWater_.compare_exchange_weak(cur, depth, std::memory_order_relaxed)){
+    }
+}
+
+inline void putPromValue(std::string& out, const std::string& value){
+    for(char c: value){
+        if(c == '\\' || c == '"'){
+            out.push_back('\\');
+            out.push_back(c);
+        }else if(c == '\n'){
+            out.append("\\n");
+        }else{
+            out.push_back(c);
+        }
+    }
+}
+
+inline void putPromHistogram(std::string& out,
+                             const char* name,
+                             const char* labels,
+                             const std::string& value,
+                             const latencyHistogram& hist){
+    auto prefix = [&](const char* suffix){
+        out.append(name).append(suffix).push_back('{');
+        if(labels != nullptr){
+            out.append(labels).append("=\"");
+            putPromValue(out, value);
+            out.append("\",");
+        }
+    };
+
+    char num[32];
+    unsigned long long cumulative = 0;
+    for(size_t i = 0; i < latencyHistogram::buckets; ++i){
+        cumulative += hist.counts[i];
+        prefix("_bucket");
+        if(i + 1 < latencyHistogram::buckets){
+            std::snprintf(num, sizeof(num), "%.10g", static_cast<double>(1ULL << i) / 1e9);
+            out.append("le=\"").append(num).append("\"} ");
+        }else{
+            out.append("le=\"+Inf\"} ");
+        }
+        out.append(std::to_string(cumulative)).push_back('\n');
+    }
+
+    std::snprintf(num, sizeof(num), "%.9g", static_cast<double>(hist.sumNs) / 1e9);
+    prefix("_sum");
+    out.back() = '}';
+    out.append(" ").append(num).push_back('\n');
+    prefix("_count");
+    out.back() = '}';
+    out.append(" ").append(std::to_string(cumulative)).push_back('\n');
+}
+
+} // namespace detail
+
+unsigned long long latencyHistogram::count() const{
+    unsigned long long ret = 0;
+    for(unsigned long long n: counts){
+        ret += n;
+    }
+    return ret;
+}
+
+unsigned long long latencyHistogram::quantileNs(double q) const{
+    const unsigned long long total = count();
+    if(total == 0){
+        return 0;
+    }
+    const double target = q * static_cast<double>(total);
+    unsigned long long cumulative = 0;
+    for(size_t i = 0; i < buckets; ++i){
+        cumulative += counts[i];
+        if(static_cast<double>(cumulative) >= target){
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (buckets - 1);
+}
+
+std::string metricsSnapshot::prometheus() const{
+    static const char* const names[] = {"fatal", "error", "warning", "notice", "info", "debug"};
+    std::string out;
+
+    out.append("# HELP ll_records_total Log records by level and outcome.\n"
+               "# TYPE ll_records_total counter\n");
+    for(size_t i = 0; i < levels; ++i){
+        out.append("ll_records_total{level=\"").append(names[i]).append("\",outcome=\"filtered\"} ")
+           .append(std::to_string(filtered[i])).push_back('\n');
+        out.append("ll_records_total{level=\"").append(names[i]).append("\",outcome=\"written\"} ")
+           .append(std::to_string(written[i])).push_back('\n');
+    }
+    out.append("# HELP ll_records_dropped_total Lines lost to a full asynchronous queue.\n"
+               "# TYPE ll_records_dropped_total counter\n"
+               "ll_records_dropped_total ").append(std::to_string(dropped)).push_back('\n');
+    out.append("# HELP ll_written_bytes_total Bytes of the written lines by level.\n"
+               "# TYPE ll_written_bytes_total counter\n");
+    for(size_t i = 0; i < levels; ++i){
+        out.append("ll_written_bytes_total{level=\"").append(names[i]).append("\"} ")
+           .append(std::to_string(bytes[i])).push_back('\n');
+    }
+
+    out.append("# HELP ll_backend_lines_total Lines written by backend.\n"
+               "# TYPE ll_backend_lines_total counter\n");
+    for(const backend& b: backends){
+        out.append("ll_backend_lines_total{backend=\"");
+        detail::putPromValue(out, b.name);
+        out.append("\"} ").append(std::to_string(b.lines)).push_back('\n');
+    }
+    out.append("# HELP ll_backend_bytes_total Bytes written by backend.\n"
+               "# TYPE ll_backend_bytes_total counter\n");
+    for(const backend& b: backends){
+        out.append("ll_backend_bytes_total{backend=\"");
+        detail::putPromValue(out, b.name);
+        out.append("\"} ").append(std::to_string(b.bytes)).push_back('\n');
+    }
+
+    out.append("# HELP ll_queue_capacity Capacity of a logging queue.\n"
+               "# TYPE ll_queue_capacity gauge\n");
+    for(const queue& q: queues){
+        out.append("ll_queue_capacity{queue=\"");
+        detail::putPromValue(out, q.name);
+        out.append("\"} ").append(std::to_string(q.capacity)).push_back('\n');
+    }
+    out.append("# HELP ll_queue_high_watermark Deepest a logging queue has been.\n"
+               "# TYPE ll_queue_high_watermark gauge\n");
+    for(const queue& q: queues){
+        out.append("ll_queue_high_watermark{queue=\"");
+        detail::putPromValue(out, q.name);
+        out.append("\"} ").append(std::to_string(q.highWater)).push_back('\n');
+    }
+
+    out.append("# HELP ll_assembly_seconds Time from the logging call to the backend.\n"
+               "# TYPE ll_assembly_seconds histogram\n");
+    detail::putPromHistogram(out, "ll_assembly_seconds", nullptr, std::string(), assembly);
+    out.append("# HELP ll_backend_log_seconds Time spent in log() of a backend.\n"
+               "# TYPE ll_backend_log_seconds histogram\n");
+    for(const backend& b: backends){
+        detail::putPromHistogram(out, "ll_backend_log_seconds", "backend", b.name, b.latency);
+    }
+    return out;
+}
+
+Metrics::Metrics(): retired_(new detail::threadMetrics),
+                   late_(new detail::threadMetrics){
+}
+
+Metrics& Metrics::global(){
+    static Metrics ret;
+    return ret;
+}
+
+metricsSnapshot Metrics::snapshot(){
+    metricsSnapshot ret;
+    std::lock_guard<std::mutex> lk(mtx_);
+
+    const size_t maxBackends = detail::threadMetrics::maxBackends;
+    const size_t backendCount = std::min(backends_.size(), maxBackends);
+    ret.backends.resize(backendCount);
+    for(size_t i = 0; i < backendCount; ++i){
+        ret.backends[i].name = i + 1 == maxBackends && backends_.size() > backendCount ?
+                               std::string("other") : backends_[i].second;
+    }
+
+    auto add = [&](const detail::threadMetrics& block){
+        for(size_t i = 0; i < levels; ++i){
+            ret.filtered[i] += block.filtered[i].get();
+            ret.written[i] += block.written[i].get();
+            ret.bytes[i] += block.bytes[i].get();
+        }
+        ret.dropped += block.dropped.get();
+        block.assembly.addTo(ret.assembly);
+        for(size_t i = 0; i < backendCount; ++i){
+            ret.backends[i].lines += block.backends[i].lines.get();
+            ret.backends[i].bytes += block.backends[i].bytes.get();
+            block.backends[i].latency.addTo(ret.backends[i].latency);
+        }
+    };
+    for(const detail::threadMetrics& block: threads_){
+        add(block);
+    }
+    add(*retired_);
+    add(*late_);
+    for(size_t i = 0; i < levels; ++i){
+        ret.produced[i] = ret.filtered[i] + ret.written[i];
+    }
+
+    for(const detail::queueGauge* gauge: queues_){
+        metricsSnapshot::queue q;
+        q.name = gauge->name_;
+        q.capacity = gauge->capacity_;
+        q.highWater = gauge->highWater_.load(std::memory_order_relaxed);
+        ret.queues.push_back(q);
+    }
+    return ret;
+}
+
+void Metrics::setTiming(bool on){
+    timingFlag().store(on, std::memory_order_relaxed);
+}
+
+bool Metrics::timing(){
+    return timingFlag().load(std::memory_order_relaxed);
+}
+
+void Metrics::nameBackend(const void* backend, const std::string& name){
+    std::lock_guard<std::mutex> lk(mtx_);
+    backends_[findBackend(backend)].second = name;
+}
+
+size_t Metrics::backendId(const void* backend){
+    std::lock_guard<std::mutex> lk(mtx_);
+    const size_t last = detail::threadMetrics::maxBackends - 1;
+    return std::min(findBackend(backend), last);
+}
+
+detail::threadMetrics& Metrics::acquire(){
+    struct releaser{
+        detail::threadMetrics* block = nullptr;
+        ~releaser(){
+            if(block != nullptr){
+                Metrics::global().release(*block);
+            }
+        }
+    };
+    // Retires the counters when this thread exits. Messages logged later
+    // by thread_local destructors go to late_.
+    static thread_local releaser owner;
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    detail::threadMetrics* ret = nullptr;
+    for(detail::threadMetrics& block: threads_){
+        if(!block.used){
+            ret = &block;
+            break;
+        }
+    }
+    if(ret == nullptr){
+        threads_.emplace_back();
+        ret = &threads_.back();
+    }
+    ret->used = true;
+    owner.block = ret;
+    return *ret;
+}
+
+void Metrics::release(detail::threadMetrics& block){
+    std::lock_guard<std::mutex> lk(mtx_);
+    // Only this thread writes the block, and it no longer will
+    detail::threadMetrics::current() = late_.get();
+    block.addTo(*retired_);
+    block.reset();
+    block.used = false;
+}
+
+size_t Metrics::findBackend(const void* backend){
+    for(size_t i = 0; i < backends_.size(); ++i){
+        if(backends_[i].first == backend){
+            return i;
+        }
+    }
+    backends_.emplace_back(backend, "backend" + std::to_string(backends_.size()));
+    return backends_.size() - 1;
+}
+
+std::atomic<bool>& Metrics::timingFlag(){
+    static std::atomic<bool> ret(false);
+    return ret;
+}
+
+}
@@ -0,0 +1,304 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lldefs.h"
+
+namespace ll{
+
+namespace detail{
+
+// Layout of a ring file: one page of ringHeader, then capacity bytes of
+// records. Each record is a ringRecord followed by its text, padded to a
+// multiple of 16 bytes. Records are placed at the monotonic byte offset
+// reserved from the cursor, modulo capacity; the text may wrap around.
+struct ringHeader{
+    static constexpr char magicStr[8] = {'L', 'L', 'R', 'I', 'N', 'G', '\0', '\1'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t size = 4096;
+
+    char magic[8];
+    uint32_t ver;
+    uint32_t headerSize;
+    uint64_t capacity;
+    // Bytes reserved since the ring was created
+    std::atomic<uint64_t> cursor;
+    // Times a reservation crossed the end of the record region
+    std::atomic<uint64_t> wraps;
+};
+
+constexpr char ringHeader::magicStr[8];
+
+struct ringRecord{
+    static constexpr uint16_t magic = 0x4c52;
+
+    // Offset the record was reserved at, stored last to commit the record.
+    // A record is valid only if this matches where it is read from.
+    std::atomic<uint64_t> pos;
+    uint32_t len;
+    uint16_t lev;
+    uint16_t mag;
+};
+
+static_assert(sizeof(ringRecord) == 16, "ring records must stay 16 bytes");
+
+inline uint64_t ringRecordSize(size_t len){
+    return (sizeof(ringRecord) + len + 15) & ~static_cast<uint64_t>(15);
+}
+
+} // namespace detail
+
+// Backend writing lines into a preallocated memory-mapped file used as a
+// circular buffer. Logging is an atomic fetch-add and a memcpy, without
+// any system call, and lines survive a crash of the process in the page
+// cache. Read the ring back with MmapRingReader or the llring tool.
+class MmapRing{
+  public:
+    // An existing ring of the same capacity is appended to
+    inline MmapRing(const std::string& path, size_t capacity = 64 << 20);
+    MmapRing(const MmapRing&) = delete;
+    inline ~MmapRing();
+
+    inline void log(const std::string& str, level lev);
+    // Write dirty pages back to the file, e.g. before a planned shutdown
+    inline void sync();
+    inline bool good() const;
+
+  private:
+    int fd_;
+    char* map_;
+    size_t mapLen_;
+    detail::ringHeader* header_;
+    char* data_;
+    uint64_t capacity_;
+
+    inline void copyIn(uint64_t pos, const char* src, size_t len);
+};
+
+MmapRing::MmapRing(const std::string& path, size_t capacity): fd_(-1),
+                                                              map_(nullptr),
+                                                              mapLen_(0),
+                                                              header_(nullptr),
+                                                              data_(nullptr),
+                                                              capacity_((capacity + 15) & ~static_cast<size_t>(15)){
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd_ < 0){
+        return;
+    }
+
+    mapLen_ = detail::ringHeader::size + capacity_;
+    struct stat st;
+    const bool reuse = fstat(fd_, &st) == 0 && static_cast<size_t>(st.st_size) == mapLen_;
+    if(!reuse && ftruncate(fd_, 0) != 0){
+        return;
+    }
+    if(!reuse && ftruncate(fd_, static_cast<off_t>(mapLen_)) != 0){
+        return;
+    }
+
+    void* map = mmap(nullptr, mapLen_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED){
+        return;
+    }
+    map_ = static_cast<char*>(map);
+    data_ = map_ + detail::ringHeader::size;
+
+    header_ = reinterpret_cast<detail::ringHeader*>(map_);
+    if(!reuse || std::memcmp(header_->magic, detail::ringHeader::magicStr, 8) != 0 ||
+       header_->ver != detail::ringHeader::version || header_->capacity != capacity_){
+        header_ = new (map_) detail::ringHeader;
+        std::memset(data_, 0, capacity_);
+        std::memcpy(header_->magic, detail::ringHeader::magicStr, 8);
+        header_->ver = detail::ringHeader::version;
+        header_->headerSize = detail::ringHeader::size;
+        header_->capacity = capacity_;
+        header_->cursor.store(0);
+        header_->wraps.store(0);
+    }
+}
+
+MmapRing::~MmapRing(){
+    if(map_ != nullptr){
+        munmap(map_, mapLen_);
+    }
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+void MmapRing::log(const std::string& str, level lev){
+    if(map_ == nullptr){
+        return;
+    }
+
+    const size_t len = std::min<size_t>(str.size(), capacity_ - sizeof(detail::ringRecord));
+    const uint64_t size = detail::ringRecordSize(len);
+    const uint64_t pos = header_->cursor.fetch_add(size, std::memory_order_relaxed);
+    if((pos + size) / capacity_ != pos / capacity_){
+        header_->wraps.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Headers never straddle the end, as offsets and capacity are multiples of 16
+    detail::ringRecord* rec = reinterpret_cast<detail::ringRecord*>(data_ + pos % capacity_);
+    // Invalidated before the fields change, so that a reader copying the
+    // record sees pos change once it is done: this is a seqlock
+    rec->pos.store(~static_cast<uint64_t>(0), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    rec->len = static_cast<uint32_t>(len);
+    rec->lev = static_cast<uint16_t>(lev);
+    rec->mag = detail::ringRecord::magic;
+    copyIn(pos + sizeof(detail::ringRecord), str.data(), len);
+    rec->pos.store(pos, std::memory_order_release);
+}
+
+void MmapRing::sync(){
+    if(map_ != nullptr){
+        msync(map_, mapLen_, MS_SYNC);
+    }
+}
+
+bool MmapRing::good() const{
+    return map_ != nullptr;
+}
+
+void MmapRing::copyIn(uint64_t pos, const char* src, size_t len){
+    const size_t off = static_cast<size_t>(pos % capacity_);
+    const size_t first = std::min<size_t>(len, capacity_ - off);
+    std::memcpy(data_ + off, src, first);
+    std::memcpy(data_, src + first, len - first);
+}
+
+// Reads the records of a ring file from the oldest to the newest
+class MmapRingReader{
+  public:
+    inline MmapRingReader(const std::string& path);
+    MmapRingReader(const MmapRingReader&) = delete;
+    inline ~MmapRingReader();
+
+    inline bool good() const;
+    inline uint64_t capacity() const;
+    inline uint64_t cursor() const;
+    inline uint64_t wraps() const;
+
+    // Call f(level, text) for every intact record still in the ring.
+    // Returns the number of bytes skipped over torn or overwritten records.
+    template<typename F>
+    inline uint64_t forEach(F&& f) const;
+
+  private:
+    int fd_;
+    const char* map_;
+    size_t mapLen_;
+    const detail::ringHeader* header_;
+    const char* data_;
+};
+
+MmapRingReader::MmapRingReader(const std::string& path): fd_(-1),
+                                                         map_(nullptr),
+                                                         mapLen_(0),
+                                                         header_(nullptr),
+                                                         data_(nullptr){
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd_ < 0 || fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) <= detail::ringHeader::size){
+        return;
+    }
+
+    void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED){
+        return;
+    }
+    const detail::ringHeader* header = static_cast<const detail::ringHeader*>(map);
+    if(std::memcmp(header->magic, detail::ringHeader::magicStr, 8) != 0 ||
+       header->ver != detail::ringHeader::version ||
+       header->headerSize + header->capacity != static_cast<uint64_t>(st.st_size)){
+        munmap(map, static_cast<size_t>(st.st_size));
+        return;
+    }
+
+    map_ = static_cast<const char*>(map);
+    mapLen_ = static_cast<size_t>(st.st_size);
+    header_ = header;
+    data_ = map_ + header->headerSize;
+}
+
+MmapRingReader::~MmapRingReader(){
+    if(map_ != nullptr){
+        munmap(const_cast<char*>(map_), mapLen_);
+    }
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+bool MmapRingReader::good() const{
+    return map_ != nullptr;
+}
+
+uint64_t MmapRingReader::capacity() const{
+    return header_->capacity;
+}
+
+uint64_t MmapRingReader::cursor() const{
+    return header_->cursor.load(std::memory_order_acquire);
+}
+
+uint64_t MmapRingReader::wraps() const{
+    return header_->wraps.load(std::memory_order_relaxed);
+}
+
+template<typename F>
+uint64_t MmapRingReader::forEach(F&& f) const{
+    const uint64_t cap = header_->capacity;
+    const uint64_t end = cursor();
+    uint64_t pos = end > cap ? ((end - cap + 15) & ~static_cast<uint64_t>(15)) : 0;
+    uint64_t skipped = 0;
+    std::string text;
+
+    while(pos < end){
+        const detail::ringRecord* rec = reinterpret_cast<const detail::ringRecord*>(data_ + pos % cap);
+        // Records carry their own offset, so torn records and leftovers of
+        // earlier laps are told apart from intact ones and stepped over.
+        // The fields are read once, as a writer lapping the reader may
+        // change them meanwhile.
+        const uint64_t recPos = rec->pos.load(std::memory_order_acquire);
+        const size_t len = std::min<size_t>(rec->len, static_cast<size_t>(cap) - sizeof(detail::ringRecord));
+        const uint16_t lev = rec->lev;
+        const uint16_t mag = rec->mag;
+        const uint64_t size = detail::ringRecordSize(len);
+        if(recPos != pos || mag != detail::ringRecord::magic || lev >= levels || pos + size > end){
+            pos += 16;
+            skipped += 16;
+            continue;
+        }
+
+        const size_t off = static_cast<size_t>((pos + sizeof(detail::ringRecord)) % cap);
+        const size_t first = std::min<size_t>(len, static_cast<size_t>(cap) - off);
+        text.assign(data_ + off, first);
+        text.append(data_, len - first);
+        // Overwritten while it was copied: the writer invalidated pos first
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(rec->pos.load(std::memory_order_relaxed) != pos){
+            pos += 16;
+            skipped += 16;
+            continue;
+        }
+        f(static_cast<level>(lev), text);
+        pos += size;
+    }
+
+    return skipped;
+}
+
+}
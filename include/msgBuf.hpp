@@ -0,0 +1,299 @@
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+namespace ll{
+
+namespace detail{
+
+// Growable byte buffer with inline storage. Lines shorter than
+// inlineCapacity are assembled without touching the heap, and lines of
+// loggers in a string reused by each thread.
+class msgBuf{
+  public:
+    static constexpr size_t inlineCapacity = 256;
+
+    inline msgBuf();
+    inline msgBuf(const msgBuf& other);
+    msgBuf& operator = (const msgBuf&) = delete;
+    inline ~msgBuf();
+
+    inline void append(const char* str, size_t len);
+    inline void append(const std::string& str);
+    inline void push_back(char c);
+    // Make room for len more bytes and return where they start
+    inline char* reserve(size_t len);
+    inline void commit(size_t len);
+    inline void resize(size_t len);
+    inline void clear();
+    // Assemble into a string kept by this thread instead, whose capacity
+    // is reused by its later lines and which str() hands out without a
+    // copy. A line logged while another is assembled on the thread gets a
+    // string of its own. The buffer must be empty.
+    inline void useThreadLine();
+
+    inline const char* data() const;
+    inline size_t size() const;
+    inline size_t capacity() const;
+    // The bytes as a string, valid until the buffer changes
+    inline const std::string& str();
+
+    // Number of heap allocations made by all message buffers so far
+    inline static unsigned long long heapAllocs();
+    inline static void countHeapAlloc();
+
+  private:
+    struct lineSlot{
+        std::string str;
+        bool busy = false;
+    };
+
+    char* data_;
+    size_t size_;
+    size_t cap_;
+    // String assembled into after useThreadLine(), sized to cap_. It is
+    // owned unless it is the one of slot_.
+    std::string* str_;
+    lineSlot* slot_;
+    char inline_[inlineCapacity];
+
+    inline void grow(size_t required);
+    inline static std::atomic<unsigned long long>& allocCounter();
+    inline static lineSlot& localSlot();
+};
+
+msgBuf::msgBuf(): data_(inline_), size_(0), cap_(inlineCapacity), str_(nullptr), slot_(nullptr){
+}
+
+msgBuf::msgBuf(const msgBuf& other): data_(inline_), size_(0), cap_(inlineCapacity), str_(nullptr), slot_(nullptr){
+    append(other.data_, other.size_);
+}
+
+msgBuf::~msgBuf(){
+    if(slot_ != nullptr){
+        slot_->busy = false;
+    }else if(str_ != nullptr){
+        delete str_;
+    }else if(data_ != inline_){
+        delete[] data_;
+    }
+}
+
+void msgBuf::append(const char* str, size_t len){
+    std::memcpy(reserve(len), str, len);
+    size_ += len;
+}
+
+void msgBuf::append(const std::string& str){
+    append(str.data(), str.size());
+}
+
+void msgBuf::push_back(char c){
+    *reserve(1) = c;
+    ++size_;
+}
+
+char* msgBuf::reserve(size_t len){
+    if(size_ + len > cap_){
+        grow(size_ + len);
+    }
+    return data_ + size_;
+}
+
+void msgBuf::commit(size_t len){
+    size_ += len;
+}
+
+void msgBuf::resize(size_t len){
+    reserve(len > size_ ? len - size_ : 0);
+    size_ = len;
+}
+
+void msgBuf::clear(){
+    size_ = 0;
+}
+
+void msgBuf::useThreadLine(){
+    if(str_ == nullptr && data_ != inline_){
+        delete[] data_;
+    }
+    lineSlot& slot = localSlot();
+    if(slot.busy){
+        countHeapAlloc();
+        str_ = new std::string;
+    }else{
+        slot.busy = true;
+        slot_ = &slot;
+        str_ = &slot.str;
+    }
+    if(str_->capacity() < inlineCapacity){
+        countHeapAlloc();
+        str_->reserve(inlineCapacity);
+    }
+    // Truncated by str() after the previous line
+    str_->resize(str_->capacity());
+    data_ = &(*str_)[0];
+    size_ = 0;
+    cap_ = str_->size();
+}
+
+const char* msgBuf::data() const{
+    return data_;
+}
+
+size_t msgBuf::size() const{
+    return size_;
+}
+
+size_t msgBuf::capacity() const{
+    return cap_;
+}
+
+const std::string& msgBuf::str(){
+    if(str_ == nullptr){
+        str_ = new std::string(data_, size_);
+        if(data_ != inline_){
+            delete[] data_;
+        }
+        data_ = &(*str_)[0];
+        cap_ = size_;
+        return *str_;
+    }
+    // Shrinking keeps the storage, and growing past size_ again resizes it
+    str_->resize(size_);
+    cap_ = size_;
+    return *str_;
+}
+
+void msgBuf::grow(size_t required){
+    size_t cap = cap_ > 0 ? cap_ * 2 : inlineCapacity;
+    while(cap < required){
+        cap *= 2;
+    }
+
+    if(str_ != nullptr){
+        if(cap > str_->capacity()){
+            countHeapAlloc();
+        }
+        str_->resize(cap);
+        data_ = &(*str_)[0];
+        cap_ = cap;
+        return;
+    }
+
+    char* data = new char[cap];
+    countHeapAlloc();
+    std::memcpy(data, data_, size_);
+    if(data_ != inline_){
+        delete[] data_;
+    }
+    data_ = data;
+    cap_ = cap;
+}
+
+unsigned long long msgBuf::heapAllocs(){
+    return allocCounter().load(std::memory_order_relaxed);
+}
+
+void msgBuf::countHeapAlloc(){
+    allocCounter().fetch_add(1, std::memory_order_relaxed);
+}
+
+std::atomic<unsigned long long>& msgBuf::allocCounter(){
+    static std::atomic<unsigned long long> ret(0);
+    return ret;
+}
+
+msgBuf::lineSlot& msgBuf::localSlot(){
+    static thread_local lineSlot ret;
+    return ret;
+}
+
+// Adapter letting std::ostream write straight into a msgBuf, so that
+// user-defined operator << overloads keep working
+class bufStreambuf: public std::streambuf{
+  public:
+    inline void attach(msgBuf& buf);
+    // Publish bytes written through the put area to the attached buffer
+    inline void publish();
+
+  protected:
+    inline int_type overflow(int_type ch) override;
+    inline std::streamsize xsputn(const char* str, std::streamsize len) override;
+
+  private:
+    msgBuf* buf_ = nullptr;
+
+    inline void reset();
+};
+
+void bufStreambuf::attach(msgBuf& buf){
+    buf_ = &buf;
+    reset();
+}
+
+void bufStreambuf::publish(){
+    buf_->commit(static_cast<size_t>(pptr() - pbase()));
+    reset();
+}
+
+bufStreambuf::int_type bufStreambuf::overflow(int_type ch){
+    publish();
+    if(!traits_type::eq_int_type(ch, traits_type::eof())){
+        buf_->push_back(traits_type::to_char_type(ch));
+        reset();
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize bufStreambuf::xsputn(const char* str, std::streamsize len){
+    publish();
+    buf_->append(str, static_cast<size_t>(len));
+    reset();
+    return len;
+}
+
+void bufStreambuf::reset(){
+    char* begin = buf_->reserve(0);
+    setp(begin, begin + (buf_->capacity() - buf_->size()));
+}
+
+// std::ostream over a bufStreambuf. One instance per thread is reused by
+// every message, as constructing a stream is expensive.
+struct bufStream{
+    bufStreambuf sb;
+    std::ostream os;
+    bool busy;
+
+    inline bufStream();
+    // Restore the state a freshly constructed stream has
+    inline void release();
+
+    inline static bufStream& local();
+};
+
+bufStream::bufStream(): os(&sb), busy(false){
+}
+
+void bufStream::release(){
+    os.clear();
+    os.flags(std::ios_base::skipws | std::ios_base::dec);
+    os.precision(6);
+    os.width(0);
+    os.fill(' ');
+    busy = false;
+}
+
+bufStream& bufStream::local(){
+    static thread_local bufStream ret;
+    return ret;
+}
+
+} // namespace detail
+
+}
@@ -0,0 +1,303 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lldefs.h"
+#include "osSync.hpp"
+#include "syslog.hpp"
+
+namespace ll{
+
+enum syslogFormat: char{
+    rfc3164, // <PRI>Mmm dd hh:mm:ss ident[pid]: message, as libc sends it
+    rfc5424  // <PRI>1 yyyy-mm-ddThh:mm:ss.uuuuuuZ host ident pid - - message
+};
+
+// Syslog backend writing to the /dev/log datagram socket itself instead
+// of going through libc syslog(). The header is rendered once but for the
+// timestamp, and lines are buffered according to a flushPolicy and sent
+// in batches with sendmmsg.
+class NativeSyslog{
+  public:
+    using SeverityMap = Syslog::SeverityMap;
+
+    inline NativeSyslog(const char* ident,
+                        int facility = LOG_USER,
+                        syslogFormat format = rfc3164,
+                        const flushPolicy& policy = flushPolicy(),
+                        const SeverityMap& severityMap = Syslog::defaultSeverityMap(),
+                        const std::string& socketPath = "/dev/log");
+    NativeSyslog(const NativeSyslog&) = delete;
+    inline ~NativeSyslog();
+
+    inline void log(const std::string& str, level lev);
+    // Send every pending line
+    inline void flush();
+    // Lines that could not be sent
+    inline unsigned long long errors() const;
+
+  private:
+    const syslogFormat format_;
+    const flushPolicy policy_;
+    const std::string path_;
+    std::string prefix_[levels];
+    std::string tag_;
+    int fd_;
+
+    // Same group commit as OStreamSync: lines are appended to pending_
+    // under mtx_, and the sending thread holds sendMtx_ and swaps them out
+    std::mutex mtx_;
+    std::mutex sendMtx_;
+    std::string pending_;
+    std::vector<size_t> ends_;
+    std::string spare_;
+    std::vector<size_t> spareEnds_;
+    std::vector<iovec> iovs_;
+    std::chrono::steady_clock::time_point lastSend_;
+    std::atomic<unsigned long long> errors_;
+
+    bool stop_;
+    std::condition_variable cv_;
+    std::thread timer_;
+
+    inline void connectSocket();
+    inline size_t stamp(char* out) const;
+    inline void send();
+    inline void runTimer();
+};
+
+NativeSyslog::NativeSyslog(const char* ident,
+                           int facility,
+                           syslogFormat format,
+                           const flushPolicy& policy,
+                           const SeverityMap& severityMap,
+                           const std::string& socketPath): format_(format),
+                                                           policy_(policy),
+                                                           path_(socketPath),
+                                                           fd_(-1),
+                                                           lastSend_(std::chrono::steady_clock::now()),
+                                                           errors_(0),
+                                                           stop_(false){
+    for(int i = 0; i < levels; ++i){
+        prefix_[i] = "<" + std::to_string(facility | severityMap[i]) + (format == rfc5424 ? ">1 " : ">");
+    }
+
+    const std::string pid = std::to_string(getpid());
+    if(format == rfc5424){
+        char host[256] = "-";
+        if(gethostname(host, sizeof(host)) != 0 || host[0] == '\0'){
+            std::strcpy(host, "-");
+        }
+        host[sizeof(host) - 1] = '\0';
+        tag_ = std::string(" ") + host + " " + ident + " " + pid + " - - ";
+    }else{
+        tag_ = std::string(" ") + ident + "[" + pid + "]: ";
+    }
+
+    connectSocket();
+    if(policy_.interval.count() > 0){
+        timer_ = std::thread(&NativeSyslog::runTimer, this);
+    }
+}
+
+NativeSyslog::~NativeSyslog(){
+    if(timer_.joinable()){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+    }
+    flush();
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+void NativeSyslog::log(const std::string& str, level lev){
+    char time[48];
+    const size_t timeLen = stamp(time);
+    const std::string& prefix = prefix_[static_cast<size_t>(lev)];
+
+    bool write;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        pending_.append(prefix);
+        pending_.append(time, timeLen);
+        pending_.append(tag_);
+        pending_.append(str);
+        ends_.push_back(pending_.size());
+        write = pending_.size() >= policy_.bytes || lev <= policy_.immediate;
+        if(!write && policy_.interval.count() > 0){
+            write = std::chrono::steady_clock::now() - lastSend_ >= policy_.interval;
+        }
+    }
+
+    if(write){
+        send();
+    }
+}
+
+void NativeSyslog::flush(){
+    send();
+}
+
+unsigned long long NativeSyslog::errors() const{
+    return errors_.load(std::memory_order_relaxed);
+}
+
+void NativeSyslog::connectSocket(){
+    if(fd_ >= 0){
+        close(fd_);
+    }
+    fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd_ < 0){
+        return;
+    }
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+    if(connect(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0){
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+size_t NativeSyslog::stamp(char* out) const{
+    struct secCache{
+        long long sec = -1;
+        syslogFormat format = rfc3164;
+        size_t len = 0;
+        char text[40];
+    };
+    static thread_local secCache cache;
+
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const long long sec = ts.tv_sec;
+    if(sec != cache.sec || format_ != cache.format){
+        std::time_t t = static_cast<std::time_t>(sec);
+        std::tm tm;
+        if(format_ == rfc5424){
+            gmtime_r(&t, &tm);
+            cache.len = std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%dT%H:%M:%S", &tm);
+        }else{
+            localtime_r(&t, &tm);
+            static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+            cache.len = static_cast<size_t>(std::snprintf(cache.text, sizeof(cache.text), "%s %2d %02d:%02d:%02d",
+                                                          months[tm.tm_mon], tm.tm_mday,
+                                                          tm.tm_hour, tm.tm_min, tm.tm_sec));
+        }
+        cache.sec = sec;
+        cache.format = format_;
+    }
+
+    std::memcpy(out, cache.text, cache.len);
+    size_t len = cache.len;
+    if(format_ == rfc5424){
+        len += static_cast<size_t>(std::snprintf(out + len, 16, ".%06ldZ", static_cast<long>(ts.tv_nsec / 1000)));
+    }
+    return len;
+}
+
+void NativeSyslog::send(){
+    std::lock_guard<std::mutex> slk(sendMtx_);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if(ends_.empty()){
+            return;
+        }
+        pending_.swap(spare_);
+        ends_.swap(spareEnds_);
+        lastSend_ = std::chrono::steady_clock::now();
+    }
+
+    const size_t count = spareEnds_.size();
+    iovs_.resize(count);
+    size_t begin = 0;
+    for(size_t i = 0; i < count; ++i){
+        iovs_[i].iov_base = &spare_[begin];
+        iovs_[i].iov_len = spareEnds_[i] - begin;
+        begin = spareEnds_[i];
+    }
+
+    size_t sent = 0;
+    bool retried = false;
+    while(sent < count){
+        if(fd_ < 0 && !retried){
+            connectSocket();
+            retried = true;
+        }
+        if(fd_ < 0){
+            break;
+        }
+
+#ifdef __linux__
+        // One system call for up to 64 lines
+        mmsghdr msgs[64];
+        const size_t batch = std::min<size_t>(count - sent, 64);
+        std::memset(msgs, 0, sizeof(mmsghdr) * batch);
+        for(size_t i = 0; i < batch; ++i){
+            msgs[i].msg_hdr.msg_iov = &iovs_[sent + i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int ret = sendmmsg(fd_, msgs, static_cast<unsigned>(batch), MSG_NOSIGNAL);
+#else
+        int ret = ::send(fd_, iovs_[sent].iov_base, iovs_[sent].iov_len, MSG_NOSIGNAL) < 0 ? -1 : 1;
+#endif
+        if(ret > 0){
+            sent += static_cast<size_t>(ret);
+        }else if(ret < 0 && errno == EINTR){
+            continue;
+        }else if(!retried && (errno == ECONNREFUSED || errno == ENOTCONN || errno == ENOENT)){
+            // The syslog daemon restarted, connect to its new socket
+            close(fd_);
+            fd_ = -1;
+        }else if(ret < 0 && errno == EMSGSIZE){
+            // Skip the line too long for a datagram
+            ++sent;
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }else{
+            break;
+        }
+    }
+
+    errors_.fetch_add(count - sent, std::memory_order_relaxed);
+    spare_.clear();
+    spareEnds_.clear();
+}
+
+void NativeSyslog::runTimer(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    while(!stop_){
+        cv_.wait_for(lk, policy_.interval);
+        if(!stop_ && !ends_.empty()){
+            lk.unlock();
+            send();
+            lk.lock();
+        }
+    }
+}
+
+}
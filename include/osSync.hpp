@@ -1,27 +1,136 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+
+#include "lldefs.h"
 
 namespace ll{
 
+// When lines buffered by OStreamSync are written to the stream
+struct flushPolicy{
+    // Pending bytes triggering a write, 0 writes every line
+    size_t bytes;
+    // Longest time a line stays pending, 0 disables the timer
+    std::chrono::milliseconds interval;
+    // Lines at this severity or above are written immediately
+    level immediate;
+
+    inline flushPolicy(size_t bytes = 0,
+                       std::chrono::milliseconds interval = std::chrono::milliseconds(0),
+                       level immediate = error);
+};
+
+flushPolicy::flushPolicy(size_t bytes, std::chrono::milliseconds interval, level immediate):
+                         bytes(bytes),
+                         interval(interval),
+                         immediate(immediate){
+}
+
 class OStreamSync{
   public:
-    inline OStreamSync(std::ostream& os);
+    inline OStreamSync(std::ostream& os, const flushPolicy& policy = flushPolicy());
+    inline ~OStreamSync();
 
-    inline void log(const std::string& str);
+    inline void log(const std::string& str, level lev = info);
+    // Write every pending line to the stream
+    inline void flush();
 
   private:
     std::ostream& os_;
+    const flushPolicy policy_;
+
+    // Lines are appended to pending_ under mtx_. The thread writing them
+    // out holds writeMtx_ and swaps pending_ with spare_, so lines logged
+    // by other threads meanwhile go to the stream in the same write.
+    std::mutex mtx_;
+    std::mutex writeMtx_;
+    std::string pending_;
+    std::string spare_;
+    std::chrono::steady_clock::time_point lastWrite_;
+
+    bool stop_;
+    std::condition_variable cv_;
+    std::thread timer_;
+
     OStreamSync(const OStreamSync&) = delete;
+
+    inline void runTimer();
 };
 
-OStreamSync::OStreamSync(std::ostream& os): os_(os){
+OStreamSync::OStreamSync(std::ostream& os, const flushPolicy& policy): os_(os),
+                                                                       policy_(policy),
+                                                                       lastWrite_(std::chrono::steady_clock::now()),
+                                                                       stop_(false){
+    if(policy_.bytes > 0){
+        pending_.reserve(policy_.bytes * 2);
+        spare_.reserve(policy_.bytes * 2);
+    }
+    if(policy_.interval.count() > 0){
+        timer_ = std::thread(&OStreamSync::runTimer, this);
+    }
 }
 
-void OStreamSync::log(const std::string& str){
-    os_ << str << std::endl;
+OStreamSync::~OStreamSync(){
+    if(timer_.joinable()){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+    }
+    flush();
 }
 
-}
\ No newline at end of file
+void OStreamSync::log(const std::string& str, level lev){
+    bool write;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        pending_.append(str);
+        pending_.push_back('\n');
+        write = pending_.size() >= policy_.bytes || lev <= policy_.immediate;
+        if(!write && policy_.interval.count() > 0){
+            write = std::chrono::steady_clock::now() - lastWrite_ >= policy_.interval;
+        }
+    }
+
+    if(write){
+        flush();
+    }
+}
+
+void OStreamSync::flush(){
+    std::lock_guard<std::mutex> wlk(writeMtx_);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if(pending_.empty()){
+            return;
+        }
+        pending_.swap(spare_);
+        lastWrite_ = std::chrono::steady_clock::now();
+    }
+
+    os_.write(spare_.data(), static_cast<std::streamsize>(spare_.size()));
+    os_.flush();
+    spare_.clear();
+}
+
+void OStreamSync::runTimer(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    while(!stop_){
+        cv_.wait_for(lk, policy_.interval);
+        if(!stop_ && !pending_.empty()){
+            lk.unlock();
+            flush();
+            lk.lock();
+        }
+    }
+}
+
+}
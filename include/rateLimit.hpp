@@ -0,0 +1,191 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+#include "lldefs.h"
+
+namespace ll{
+
+// Predicates capping how many messages of a statement are logged. Declare
+// them static so that every call site has its own state, and call them as
+// the predicate of a llogger:
+//   static ll::every_n storm(1000);
+//   logger(ll::error, storm()) << "write failed: " << err;
+// When a message passes after others were dropped, the logger appends
+// " [N messages suppressed]" to it. All of them are lock-free.
+
+// Let one message in n pass, starting with the first
+class every_n{
+  public:
+    inline explicit every_n(unsigned long long n);
+
+    inline passed operator() ();
+
+  private:
+    const unsigned long long n_;
+    std::atomic<unsigned long long> count_;
+};
+
+every_n::every_n(unsigned long long n): n_(n == 0 ? 1 : n),
+                                        count_(0){
+}
+
+passed every_n::operator() (){
+    const unsigned long long count = count_.fetch_add(1, std::memory_order_relaxed);
+    if(count % n_ != 0){
+        return passed{false, 0};
+    }
+    return passed{true, count == 0 ? 0 : n_ - 1};
+}
+
+// Let the first n messages pass, then one in every of the others, which
+// reports those dropped since. With every 0 the others are all dropped and
+// their number is only available from suppressed(), so the default still
+// lets a summary through now and then.
+class first_n{
+  public:
+    static constexpr unsigned long long defaultEvery = 1000;
+
+    inline explicit first_n(unsigned long long n, unsigned long long every = defaultEvery);
+
+    inline passed operator() ();
+    // Messages dropped so far
+    inline unsigned long long suppressed() const;
+
+  private:
+    const unsigned long long n_;
+    const unsigned long long every_;
+    std::atomic<unsigned long long> count_;
+};
+
+first_n::first_n(unsigned long long n, unsigned long long every): n_(n),
+                                                                  every_(every),
+                                                                  count_(0){
+}
+
+passed first_n::operator() (){
+    const unsigned long long count = count_.fetch_add(1, std::memory_order_relaxed);
+    if(count < n_){
+        return passed{true, 0};
+    }
+    if(every_ == 0 || (count - n_ + 1) % every_ != 0){
+        return passed{false, 0};
+    }
+    return passed{true, every_ - 1};
+}
+
+unsigned long long first_n::suppressed() const{
+    const unsigned long long count = count_.load(std::memory_order_relaxed);
+    if(count <= n_){
+        return 0;
+    }
+    return every_ == 0 ? count - n_ : count - n_ - (count - n_) / every_;
+}
+
+// Let at most n messages pass in every second of a monotonic clock
+class per_second{
+  public:
+    inline explicit per_second(uint32_t n);
+
+    inline passed operator() ();
+
+  private:
+    const uint32_t n_;
+    // Second of the current window in the high half, messages seen in it
+    // in the low half
+    std::atomic<uint64_t> window_;
+    std::atomic<unsigned long long> dropped_;
+
+    inline static uint32_t second();
+};
+
+per_second::per_second(uint32_t n): n_(n),
+                                    window_(0),
+                                    dropped_(0){
+}
+
+passed per_second::operator() (){
+    if(n_ == 0){
+        return passed{false, 0};
+    }
+
+    const uint64_t sec = second();
+    uint64_t window = window_.load(std::memory_order_relaxed);
+    for(;;){
+        if(window >> 32 != sec){
+            if(window_.compare_exchange_weak(window, sec << 32 | 1, std::memory_order_relaxed)){
+                break;
+            }
+        }else if((window & 0xffffffffU) >= n_){
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return passed{false, 0};
+        }else if(window_.compare_exchange_weak(window, window + 1, std::memory_order_relaxed)){
+            break;
+        }
+    }
+
+    return passed{true, dropped_.load(std::memory_order_relaxed) == 0 ? 0 :
+                        dropped_.exchange(0, std::memory_order_relaxed)};
+}
+
+uint32_t per_second::second(){
+#if defined(CLOCK_MONOTONIC_COARSE)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    // Start at 1 so that the first window never matches the initial state
+    return static_cast<uint32_t>(ts.tv_sec) + 1;
+#else
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count()) + 1;
+#endif
+}
+
+// Let each message pass with the given probability
+class sample{
+  public:
+    inline explicit sample(double probability);
+
+    inline passed operator() ();
+
+  private:
+    uint64_t threshold_;
+    std::atomic<unsigned long long> dropped_;
+
+    inline static uint64_t random();
+};
+
+sample::sample(double probability): threshold_(0),
+                                    dropped_(0){
+    if(probability >= 1){
+        threshold_ = UINT64_MAX;
+    }else if(probability > 0){
+        threshold_ = static_cast<uint64_t>(probability * 18446744073709551616.0);
+    }
+}
+
+passed sample::operator() (){
+    if(random() >= threshold_){
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return passed{false, 0};
+    }
+    return passed{true, dropped_.load(std::memory_order_relaxed) == 0 ? 0 :
+                        dropped_.exchange(0, std::memory_order_relaxed)};
+}
+
+uint64_t sample::random(){
+    // xorshift64*, seeded per thread from its state's address
+    static thread_local uint64_t state = 0;
+    if(state == 0){
+        state = reinterpret_cast<uintptr_t>(&state) * 0x9e3779b97f4a7c15ULL | 1;
+    }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+}
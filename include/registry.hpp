@@ -0,0 +1,236 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lldefs.h"
+
+namespace ll{
+
+// Levels of named loggers arranged by dots: "net.http.client" takes the
+// level of "net.http", which takes that of "net", up to the root "",
+// unless one is set for it. Every llogger constructed with a name keeps
+// its effective level in its own atomic, which the registry rewrites when
+// levels change, so that logging never looks the hierarchy up.
+class Registry{
+  public:
+    inline static Registry& global();
+
+    // Set the level of name, and of the names below it without their own
+    inline void setLevel(const std::string& name, level lev);
+    // Make name take the level of its parent again. The root keeps its
+    // level.
+    inline void resetLevel(const std::string& name);
+    inline level effectiveLevel(const std::string& name);
+
+    // Replace every level set so far by those of a config, one
+    // "name = level" per line, where the root is named "root" and '#'
+    // starts a comment. Nothing changes if a line is invalid, in which
+    // case error describes it.
+    inline bool configure(std::istream& in, std::string* error = nullptr);
+    inline bool load(const std::string& path, std::string* error = nullptr);
+
+    // Called by llogger: store the effective level of name into lev until
+    // detach
+    inline void attach(const std::string& name, std::atomic<level>* lev);
+    inline void detach(const std::string& name, std::atomic<level>* lev);
+
+  private:
+    struct node{
+        bool own = false;
+        level lev = info;
+        level effective = info;
+        std::vector<std::atomic<level>*> loggers;
+    };
+
+    std::mutex mtx_;
+    // Sorted by name, so that the names below "a.b" follow it
+    std::map<std::string, node> nodes_;
+
+    inline Registry();
+
+    inline node& find(const std::string& name);
+    inline level inherited(const std::string& name) const;
+    inline void update(std::map<std::string, node>::iterator it);
+    inline void propagate(const std::string& name);
+
+    inline static bool parseLevel(const std::string& text, level& lev);
+};
+
+Registry::Registry(){
+    node& root = nodes_[""];
+    root.own = true;
+}
+
+Registry& Registry::global(){
+    static Registry ret;
+    return ret;
+}
+
+void Registry::setLevel(const std::string& name, level lev){
+    std::lock_guard<std::mutex> lk(mtx_);
+    node& n = find(name);
+    n.own = true;
+    n.lev = lev;
+    propagate(name);
+}
+
+void Registry::resetLevel(const std::string& name){
+    if(name.empty()){
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mtx_);
+    find(name).own = false;
+    propagate(name);
+}
+
+level Registry::effectiveLevel(const std::string& name){
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = nodes_.find(name);
+    return it != nodes_.end() ? it->second.effective : inherited(name);
+}
+
+bool Registry::configure(std::istream& in, std::string* error){
+    std::vector<std::pair<std::string, level> > levels;
+    std::string line;
+    for(size_t no = 1; std::getline(in, line); ++no){
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        auto trim = [](const std::string& str){
+            size_t begin = 0;
+            size_t end = str.size();
+            while(begin < end && std::isspace(static_cast<unsigned char>(str[begin]))){
+                ++begin;
+            }
+            while(end > begin && std::isspace(static_cast<unsigned char>(str[end - 1]))){
+                --end;
+            }
+            return str.substr(begin, end - begin);
+        };
+        if(trim(line).empty()){
+            continue;
+        }
+
+        const size_t eq = line.find('=');
+        std::string name = eq == std::string::npos ? std::string() : trim(line.substr(0, eq));
+        level lev;
+        if(name.empty() || !parseLevel(trim(line.substr(eq + 1)), lev)){
+            if(error != nullptr){
+                *error = "line " + std::to_string(no) + ": expected name = level";
+            }
+            return false;
+        }
+        levels.emplace_back(name == "root" ? std::string() : name, lev);
+    }
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    for(auto& entry: nodes_){
+        entry.second.own = entry.first.empty();
+    }
+    nodes_[""].lev = info;
+    for(const auto& entry: levels){
+        node& n = find(entry.first);
+        n.own = true;
+        n.lev = entry.second;
+    }
+    for(auto it = nodes_.begin(); it != nodes_.end(); ++it){
+        update(it);
+    }
+    return true;
+}
+
+bool Registry::load(const std::string& path, std::string* error){
+    std::ifstream in(path);
+    if(!in){
+        if(error != nullptr){
+            *error = "cannot open " + path;
+        }
+        return false;
+    }
+    return configure(in, error);
+}
+
+void Registry::attach(const std::string& name, std::atomic<level>* lev){
+    std::lock_guard<std::mutex> lk(mtx_);
+    node& n = find(name);
+    n.loggers.push_back(lev);
+    lev->store(n.effective, std::memory_order_relaxed);
+}
+
+void Registry::detach(const std::string& name, std::atomic<level>* lev){
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = nodes_.find(name);
+    if(it != nodes_.end()){
+        std::vector<std::atomic<level>*>& loggers = it->second.loggers;
+        loggers.erase(std::remove(loggers.begin(), loggers.end(), lev), loggers.end());
+    }
+}
+
+Registry::node& Registry::find(const std::string& name){
+    auto it = nodes_.find(name);
+    if(it == nodes_.end()){
+        it = nodes_.emplace(name, node()).first;
+        it->second.effective = inherited(name);
+    }
+    return it->second;
+}
+
+level Registry::inherited(const std::string& name) const{
+    // Closest ancestor present, the root at least
+    std::string parent = name;
+    while(!parent.empty()){
+        const size_t dot = parent.rfind('.');
+        parent.resize(dot == std::string::npos ? 0 : dot);
+        auto it = nodes_.find(parent);
+        if(it != nodes_.end()){
+            return it->second.effective;
+        }
+    }
+    return nodes_.at("").effective;
+}
+
+void Registry::update(std::map<std::string, node>::iterator it){
+    node& n = it->second;
+    n.effective = n.own ? n.lev : inherited(it->first);
+    for(std::atomic<level>* lev: n.loggers){
+        lev->store(n.effective, std::memory_order_relaxed);
+    }
+}
+
+void Registry::propagate(const std::string& name){
+    // Ancestors sort before their descendants, which all start with "name."
+    auto it = nodes_.find(name);
+    auto end = name.empty() ? nodes_.end() : nodes_.lower_bound(name + '/');
+    for(; it != end; ++it){
+        update(it);
+    }
+}
+
+bool Registry::parseLevel(const std::string& text, level& lev){
+    static const char* const names[] = {"fatal", "error", "warning", "notice", "info", "debug"};
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c){
+        return static_cast<char>(std::tolower(c));
+    });
+    if(lower == "silent" || lower == "off"){
+        lev = silent;
+        return true;
+    }
+    for(int i = 0; i < levels; ++i){
+        if(lower == names[i]){
+            lev = static_cast<level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+}
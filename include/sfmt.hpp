@@ -0,0 +1,222 @@
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "llogger.h"
+
+#if !((defined(_MSVC_LANG) && _MSVC_LANG >= 201402L) || __cplusplus >= 201402L)
+#error "Compile-time formats require C++14 or above"
+#endif
+
+namespace ll{
+
+// Segments of a compile-time format, see ll::fmt
+namespace sfmt{
+
+template<char... Cs>
+struct chars{
+    static constexpr char str[sizeof...(Cs) + 1] = {Cs..., '\0'};
+};
+
+template<char... Cs>
+constexpr char chars<Cs...>::str[];
+
+template<int digits>
+struct timeOf{};
+
+using time   = timeOf<0>;
+using timeMs = timeOf<3>;
+using timeUs = timeOf<6>;
+using timeNs = timeOf<9>;
+
+struct level{};
+struct logStr{};
+
+// Fn is a default constructible callable returning std::string, or
+// appending through a fmtWriter&
+template<typename Fn>
+struct call{};
+
+using threadId = call<detail::putThreadId>;
+using pid      = call<detail::putProcessId>;
+using source   = call<detail::putSource>;
+
+// Number of the message among those rendered with formats of the same
+// type, starting at 1
+struct seq{};
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+template<size_t N>
+struct literal{
+    char str[N];
+
+    constexpr literal(const char (&s)[N]){
+        for(size_t i = 0; i < N; ++i){
+            str[i] = s[i];
+        }
+    }
+};
+
+template<literal S, typename I>
+struct litChars;
+
+template<literal S, size_t... I>
+struct litChars<S, std::index_sequence<I...> >{
+    using type = chars<S.str[I]...>;
+};
+
+// lit<"text"> is chars<'t', 'e', 'x', 't'>
+template<literal S>
+using lit = typename litChars<S, std::make_index_sequence<sizeof(S.str) - 1> >::type;
+#endif
+
+} // namespace sfmt
+
+namespace detail{
+
+template<typename... Ss>
+struct segList{};
+
+template<typename... Cs>
+struct chunkList{};
+
+// Prepend a segment to the first chunk, merging adjacent literals and
+// starting a new chunk at every logStr
+template<typename S, typename C>
+struct pushSeg;
+
+template<typename S, typename... Ss, typename... Cs>
+struct pushSeg<S, chunkList<segList<Ss...>, Cs...> >{
+    using type = chunkList<segList<S, Ss...>, Cs...>;
+};
+
+template<char... As, char... Bs, typename... Ss, typename... Cs>
+struct pushSeg<sfmt::chars<As...>, chunkList<segList<sfmt::chars<Bs...>, Ss...>, Cs...> >{
+    using type = chunkList<segList<sfmt::chars<As..., Bs...>, Ss...>, Cs...>;
+};
+
+template<typename... Ss, typename... Cs>
+struct pushSeg<sfmt::logStr, chunkList<segList<Ss...>, Cs...> >{
+    using type = chunkList<segList<>, segList<Ss...>, Cs...>;
+};
+
+template<typename... Segs>
+struct splitChunks{
+    using type = chunkList<segList<> >;
+};
+
+template<typename S, typename... Segs>
+struct splitChunks<S, Segs...>{
+    using type = typename pushSeg<S, typename splitChunks<Segs...>::type>::type;
+};
+
+template<typename L, char... Cs>
+inline void putSeg(L& lg, sfmt::chars<Cs...>){
+    lg.buf_.append(sfmt::chars<Cs...>::str, sizeof...(Cs));
+}
+
+template<typename L, int digits>
+inline void putSeg(L& lg, sfmt::timeOf<digits>){
+    lg.putTime(digits);
+}
+
+template<typename L>
+inline void putSeg(L& lg, sfmt::level){
+    lg.putLevel();
+}
+
+template<typename L, typename Fn, typename std::enable_if<
+    !isCallable<Fn&, fmtWriter&>::value, bool>::type = true>
+inline void putSeg(L& lg, sfmt::call<Fn>){
+    lg.buf_.append(Fn()());
+}
+
+template<typename L, typename Fn, typename std::enable_if<
+    isCallable<Fn&, fmtWriter&>::value, bool>::type = true>
+inline void putSeg(L& lg, sfmt::call<Fn>){
+    fmtWriter writer(lg.buf_, lg.loc_);
+    Fn()(writer);
+}
+
+template<typename F>
+inline std::atomic<unsigned long long>& seqCount(){
+    static std::atomic<unsigned long long> ret(0);
+    return ret;
+}
+
+template<typename B, typename F>
+inline void putSeg(logger<B, F>& lg, sfmt::seq){
+    fmtWriter writer(lg.buf_, lg.loc_);
+    writer << seqCount<F>().fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+template<typename L, typename... Ss>
+inline void putChunk(L& lg, segList<Ss...>){
+    int expand[] = {0, (putSeg(lg, Ss()), 0)...};
+    (void)expand;
+}
+
+template<size_t I, typename L>
+inline void putChunkAt(L&, size_t, chunkList<>){
+}
+
+template<size_t I, typename L, typename C, typename... Cs>
+inline void putChunkAt(L& lg, size_t idx, chunkList<C, Cs...>){
+    if(idx == I){
+        putChunk(lg, C());
+    }else{
+        putChunkAt<I + 1>(lg, idx, chunkList<Cs...>());
+    }
+}
+
+} // namespace detail
+
+// Format fixed at compile time, a drop-in alternative to llfmt:
+//   namespace sf = ll::sfmt;
+//   ll::fmt<sf::lit<"[">, sf::time, sf::lit<"] ">,
+//           sf::level, sf::lit<": ">, sf::logStr> f;
+//   ll::llogger<ll::OStreamSync, decltype(f)> logger(ll::info, backend, f);
+// Adjacent literals are merged and every chunk between logStr segments
+// renders as straight-line code.
+template<typename... Segs>
+class fmt{
+  public:
+    using state = size_t;
+    using levelStrArr = llfmt::levelStrArr;
+
+    inline fmt(const levelStrArr& levelNames = llfmt::defaultLevelStr(), clockSource clock = realtime);
+
+    inline state getIters() const;
+    template<typename L>
+    inline void render(L& lg, state& st) const;
+
+  private:
+    template<typename, typename>
+    friend struct detail::logger;
+
+    using chunks = typename detail::splitChunks<Segs...>::type;
+
+    const levelStrArr& levelNames_;
+    clockSource clock_;
+};
+
+template<typename... Segs>
+fmt<Segs...>::fmt(const levelStrArr& levelNames, clockSource clock): levelNames_(levelNames),
+                                                                    clock_(clock){
+}
+
+template<typename... Segs>
+typename fmt<Segs...>::state fmt<Segs...>::getIters() const{
+    return 0;
+}
+
+template<typename... Segs>
+template<typename L>
+void fmt<Segs...>::render(L& lg, state& st) const{
+    detail::putChunkAt<0>(lg, st++, chunks());
+}
+
+}
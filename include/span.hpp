@@ -0,0 +1,155 @@
+
+#pragma once
+
+#include <chrono>
+
+#include "llogger.h"
+#include "timestamp.hpp"
+
+namespace ll{
+
+namespace detail{
+
+// Timestamps of spans: time stamp counter ticks where available, or
+// steady_clock nanoseconds
+inline unsigned long long spanTicks(){
+#ifdef LL_HAS_TSC
+    return tscClock::ticks();
+#else
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+inline long long spanNs(unsigned long long start, unsigned long long end){
+#ifdef LL_HAS_TSC
+    return tscClock::durationNs(end - start);
+#else
+    return static_cast<long long>(end - start);
+#endif
+}
+
+// The counter is calibrated for a few milliseconds on first use, which
+// is done before the first span starts rather than inside it
+inline void spanCalibrate(){
+#ifdef LL_HAS_TSC
+    static const long long calibrated = tscClock::durationNs(0);
+    (void)calibrated;
+#endif
+}
+
+// Span ids are taken by each thread in blocks, so that they are unique
+// without touching a shared counter for every span
+inline unsigned long long nextSpanId(){
+    static constexpr unsigned long long blockSize = 1 << 16;
+    static std::atomic<unsigned long long> nextBlock(0);
+    static thread_local unsigned long long next = 0;
+    static thread_local unsigned long long end = 0;
+    if(next == end){
+        next = nextBlock.fetch_add(blockSize, std::memory_order_relaxed) + 1;
+        end = next + blockSize;
+    }
+    return next++;
+}
+
+} // namespace detail
+
+// Times a scope and logs its name and duration when it ends:
+//     ll::span s(logger, "db.query", ll::info, std::chrono::milliseconds(5));
+// A span is only logged if it lasted at least threshold, so that fast
+// iterations of a hot path cost two clock reads and no formatting. Spans
+// opened while another one is open on the same thread are its children,
+// and are logged with its id as parent_id.
+class span{
+  public:
+    template<typename B, typename F>
+    inline span(llogger<B, F>& logger,
+                const char* name,
+                level lev = info,
+                std::chrono::nanoseconds threshold = std::chrono::nanoseconds(0));
+    span(const span&) = delete;
+    inline ~span();
+
+    // 0 for a span disabled by the level of its llogger
+    inline unsigned long long id() const;
+    inline unsigned long long parentId() const;
+    inline long long elapsedNs() const;
+
+  private:
+    void* logger_;
+    void (*emit_)(void*, const span&, long long);
+    const char* name_;
+    const level lev_;
+    const long long thresholdNs_;
+    unsigned long long id_;
+    span* parent_;
+    unsigned long long start_;
+
+    template<typename B, typename F>
+    inline static void emit(void* logger, const span& s, long long ns);
+
+    // Innermost open span of the thread
+    inline static span*& current();
+};
+
+template<typename B, typename F>
+span::span(llogger<B, F>& logger,
+           const char* name,
+           level lev,
+           std::chrono::nanoseconds threshold): logger_(&logger),
+                                                emit_(&span::emit<B, F>),
+                                                name_(name),
+                                                lev_(lev),
+                                                thresholdNs_(static_cast<long long>(threshold.count())),
+                                                id_(0),
+                                                parent_(nullptr),
+                                                start_(0){
+    if(lev <= minLevel && lev <= logger.getLevel()){
+        detail::spanCalibrate();
+        id_ = detail::nextSpanId();
+        parent_ = current();
+        current() = this;
+        start_ = detail::spanTicks();
+    }
+}
+
+span::~span(){
+    if(id_ == 0){
+        return;
+    }
+    const long long ns = detail::spanNs(start_, detail::spanTicks());
+    current() = parent_;
+    if(ns >= thresholdNs_){
+        emit_(logger_, *this, ns);
+    }
+}
+
+unsigned long long span::id() const{
+    return id_;
+}
+
+unsigned long long span::parentId() const{
+    return parent_ != nullptr ? parent_->id_ : 0;
+}
+
+long long span::elapsedNs() const{
+    return id_ != 0 ? detail::spanNs(start_, detail::spanTicks()) : 0;
+}
+
+template<typename B, typename F>
+void span::emit(void* logger, const span& s, long long ns){
+    llogger<B, F>& lg = *static_cast<llogger<B, F>*>(logger);
+    if(s.parent_ != nullptr){
+        lg(s.lev_) << s.name_ << kv("span_id", s.id_) << kv("parent_id", s.parent_->id_)
+                   << kv("duration_us", static_cast<double>(ns) / 1e3);
+    }else{
+        lg(s.lev_) << s.name_ << kv("span_id", s.id_) << kv("duration_us", static_cast<double>(ns) / 1e3);
+    }
+}
+
+span*& span::current(){
+    static thread_local span* ret = nullptr;
+    return ret;
+}
+
+}
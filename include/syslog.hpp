@@ -24,9 +24,10 @@ class Syslog{
 
     inline void log(const std::string& str, level lev) const;
 
+    inline static const SeverityMap& defaultSeverityMap();
+
   private:
     const SeverityMap& severityMap_;
-    inline static const SeverityMap& defaultSeverityMap();
   
 };
 
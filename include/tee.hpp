@@ -0,0 +1,366 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llogger.h"
+
+namespace ll{
+
+class Tee;
+
+namespace detail{
+
+// Clock readings of one message, shared by the formats of all sinks so
+// that they render the same time
+struct teeClocks{
+    long long ns[4];
+    unsigned char read = 0;
+
+    inline long long get(clockSource src);
+};
+
+long long teeClocks::get(clockSource src){
+    const unsigned char bit = static_cast<unsigned char>(1U << static_cast<unsigned>(src));
+    if(!(read & bit)){
+        ns[static_cast<size_t>(src)] = clockNs(src);
+        read |= bit;
+    }
+    return ns[static_cast<size_t>(src)];
+}
+
+// Renders the llfmt of a sink around a finished message: the segment
+// before the first logStr, the message, then every following segment.
+// With jsonStr or logfmtStr the message becomes an escaped msg field; kv
+// fields were already inlined in it by the llogger. Escaped text and
+// appenders are written to scratch first, whose storage is reused.
+class teeRender{
+  public:
+    inline teeRender(const llfmt& format,
+                     level lev,
+                     const sourceLoc& loc,
+                     teeClocks& clocks,
+                     msgBuf& scratch,
+                     std::string& out);
+
+    inline void render(const std::string& msg);
+
+    inline void putFmtStr(fmtItrs& state);
+    inline void putLogLev(fmtItrs& state);
+    inline void timeStamp(fmtItrs& state);
+    inline void timeStampMs(fmtItrs& state);
+    inline void timeStampUs(fmtItrs& state);
+    inline void timeStampNs(fmtItrs& state);
+    inline void putFmtLmb(fmtItrs& state);
+    inline void putFmtApp(fmtItrs& state);
+
+  private:
+    const llfmt& fmt_;
+    const level lev_;
+    const sourceLoc loc_;
+    teeClocks& clocks_;
+    msgBuf& scratch_;
+    std::string& out_;
+
+    inline void putTime(int digits);
+};
+
+teeRender::teeRender(const llfmt& format,
+                     level lev,
+                     const sourceLoc& loc,
+                     teeClocks& clocks,
+                     msgBuf& scratch,
+                     std::string& out): fmt_(format),
+                                        lev_(lev),
+                                        loc_(loc),
+                                        clocks_(clocks),
+                                        scratch_(scratch),
+                                        out_(out){
+}
+
+void teeRender::render(const std::string& msg){
+    out_.clear();
+    fmtItrs state = fmt_.getIters();
+    fmt_.render(*this, state);
+    const kvEncoding encoding = fmt_.encoding();
+    if(encoding == plain){
+        out_.append(msg);
+    }else{
+        out_.append(encoding == json ? "\"msg\":\"" : "msg=\"");
+        scratch_.clear();
+        escapeTo(scratch_, msg.data(), msg.data() + msg.size(), encoding);
+        out_.append(scratch_.data(), scratch_.size());
+        out_.push_back('"');
+    }
+    for(size_t i = 1; i < fmt_.segments(); ++i){
+        fmt_.render(*this, state);
+    }
+}
+
+void teeRender::putFmtStr(fmtItrs& state){
+    out_.append(*(state.fmtStrIter++));
+}
+
+void teeRender::putLogLev(fmtItrs&){
+    out_.append(fmt_.levelNames()[static_cast<size_t>(lev_)]);
+}
+
+void teeRender::timeStamp(fmtItrs&){
+    putTime(0);
+}
+
+void teeRender::timeStampMs(fmtItrs&){
+    putTime(3);
+}
+
+void teeRender::timeStampUs(fmtItrs&){
+    putTime(6);
+}
+
+void teeRender::timeStampNs(fmtItrs&){
+    putTime(9);
+}
+
+void teeRender::putFmtLmb(fmtItrs& state){
+    out_.append((*(state.fmtLmbIter++))());
+}
+
+void teeRender::putFmtApp(fmtItrs& state){
+    scratch_.clear();
+    fmtWriter writer(scratch_, loc_);
+    (*(state.fmtAppIter++))(writer);
+    out_.append(scratch_.data(), scratch_.size());
+}
+
+void teeRender::putTime(int digits){
+    char text[48];
+    size_t len = renderTime(text, clocks_.get(fmt_.clock()), digits);
+    if(fmt_.encoding() == plain){
+        out_.append(text, len);
+    }else{
+        // yyyy-mm-ddThh:mm:ss[.fraction] without padding, as the llogger
+        text[11] = 'T';
+        out_.append(text + 1, len - 2);
+    }
+}
+
+// Lines rendered for the message being dispatched, one per format. Kept
+// per thread so that their capacity is reused by the following messages.
+class teeCache{
+  public:
+    inline const std::string& line(const llfmt& format, const std::string& msg, level lev, const sourceLoc& loc);
+
+    inline static teeCache& local();
+
+  private:
+    friend class ll::Tee;
+
+    struct entry{
+        const llfmt* format;
+        unsigned long long gen;
+        std::string line;
+    };
+
+    std::vector<entry> entries_;
+    teeClocks clocks_;
+    msgBuf scratch_;
+    // Incremented for every message, entries of older ones are stale
+    unsigned long long gen_ = 0;
+    bool busy_ = false;
+};
+
+const std::string& teeCache::line(const llfmt& format, const std::string& msg, level lev, const sourceLoc& loc){
+    entry* slot = nullptr;
+    for(entry& e: entries_){
+        if(e.format == &format){
+            if(e.gen == gen_){
+                return e.line;
+            }
+            slot = &e;
+            break;
+        }
+        if(slot == nullptr && e.gen != gen_){
+            slot = &e;
+        }
+    }
+    if(slot == nullptr){
+        entries_.push_back(entry{nullptr, 0, std::string()});
+        slot = &entries_.back();
+    }
+
+    slot->format = &format;
+    slot->gen = gen_;
+    teeRender(format, lev, loc, clocks_, scratch_, slot->line).render(msg);
+    return slot->line;
+}
+
+teeCache& teeCache::local(){
+    static thread_local teeCache ret;
+    return ret;
+}
+
+} // namespace detail
+
+// Backend sending every line to several sinks, each with its own minimum
+// level and llfmt. The message is rendered once per distinct format, and
+// sinks sharing a format are handed the same line. The enabled level of
+// the unnamed lloggers writing to it follows maxLevel().
+class Tee{
+  public:
+    inline Tee() = default;
+    Tee(const Tee&) = delete;
+
+    // Add a sink receiving the lines at lev or more severe. Sinks are
+    // added before logging starts, and return their index.
+    template<typename B>
+    inline size_t add(B& backend,
+                      level lev = debug,
+                      const llfmt& format = detail::defaultFormat<llfmt>());
+
+    // The level of a sink can be changed while other threads log
+    inline void setLevel(size_t sink, level lev);
+    inline level getLevel(size_t sink) const;
+    // Least severe level a sink receives, for the level of the llogger
+    inline level maxLevel() const;
+
+    inline void log(const std::string& str, level lev);
+
+    // Called by llogger: store maxLevel() into lev until detach
+    inline void attach(std::atomic<level>* lev);
+    inline void detach(std::atomic<level>* lev);
+
+  private:
+    struct sink{
+        inline sink(void* backend, void (*log)(void*, const std::string&, level), level lev, const llfmt& format);
+
+        void* backend;
+        void (*log)(void*, const std::string&, level);
+        std::atomic<level> lev;
+        const llfmt& format;
+    };
+
+    // A deque keeps the atomic levels in place as sinks are added
+    std::deque<sink> sinks_;
+    std::mutex mtx_;
+    std::vector<std::atomic<level>*> loggers_;
+
+    // Store maxLevel() into the levels of the loggers, under mtx_
+    inline void update();
+
+    template<typename B>
+    inline static void logTo(void* backend, const std::string& str, level lev);
+};
+
+Tee::sink::sink(void* backend,
+                void (*log)(void*, const std::string&, level),
+                level lev,
+                const llfmt& format): backend(backend),
+                                      log(log),
+                                      lev(lev),
+                                      format(format){
+}
+
+template<typename B>
+size_t Tee::add(B& backend, level lev, const llfmt& format){
+    sinks_.emplace_back(&backend, &Tee::logTo<B>, lev, format);
+    std::lock_guard<std::mutex> lk(mtx_);
+    update();
+    return sinks_.size() - 1;
+}
+
+void Tee::setLevel(size_t sink, level lev){
+    sinks_[sink].lev.store(lev, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(mtx_);
+    update();
+}
+
+level Tee::getLevel(size_t sink) const{
+    return sinks_[sink].lev.load(std::memory_order_relaxed);
+}
+
+level Tee::maxLevel() const{
+    level ret = silent;
+    for(const sink& s: sinks_){
+        ret = std::max(ret, s.lev.load(std::memory_order_relaxed));
+    }
+    return ret;
+}
+
+void Tee::log(const std::string& str, level lev){
+    // A sink may itself log through a Tee on this thread
+    detail::teeCache& local = detail::teeCache::local();
+    detail::teeCache own;
+    detail::teeCache& cache = local.busy_ ? own : local;
+
+    struct busyGuard{
+        detail::teeCache& cache;
+        ~busyGuard(){
+            cache.busy_ = false;
+        }
+    } guard{cache};
+    cache.busy_ = true;
+    ++cache.gen_;
+    cache.clocks_.read = 0;
+
+    const sourceLoc loc = *detail::dispatchLoc();
+    for(sink& s: sinks_){
+        if(lev <= s.lev.load(std::memory_order_relaxed)){
+            s.log(s.backend, cache.line(s.format, str, lev, loc), lev);
+        }
+    }
+}
+
+void Tee::attach(std::atomic<level>* lev){
+    std::lock_guard<std::mutex> lk(mtx_);
+    loggers_.push_back(lev);
+    lev->store(maxLevel(), std::memory_order_relaxed);
+}
+
+void Tee::detach(std::atomic<level>* lev){
+    std::lock_guard<std::mutex> lk(mtx_);
+    loggers_.erase(std::remove(loggers_.begin(), loggers_.end(), lev), loggers_.end());
+}
+
+void Tee::update(){
+    const level lev = maxLevel();
+    for(std::atomic<level>* logger: loggers_){
+        logger->store(lev, std::memory_order_relaxed);
+    }
+}
+
+template<typename B>
+void Tee::logTo(void* backend, const std::string& str, level lev){
+    detail::backendLog(*static_cast<B*>(backend), str, lev);
+}
+
+namespace detail{
+
+// A llogger writing to a Tee renders only the message, and the sinks
+// render their own format around it
+template<>
+struct backendFormat<Tee, llfmt>{
+    inline static const llfmt& get(){
+        static const llfmt ret = llfmt(llfmt() << llfmt::logStr);
+        return ret;
+    }
+};
+
+template<>
+struct backendLevel<Tee>{
+    inline static void attach(Tee& backend, std::atomic<level>* lev){
+        backend.attach(lev);
+    }
+    inline static void detach(Tee& backend, std::atomic<level>* lev){
+        backend.detach(lev);
+    }
+};
+
+} // namespace detail
+
+}
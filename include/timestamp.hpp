@@ -0,0 +1,246 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LL_HAS_TSC 1
+#endif
+
+namespace ll{
+
+enum clockSource: char{
+    realtime,       // CLOCK_REALTIME
+    realtimeCoarse, // CLOCK_REALTIME_COARSE, tick-granular but cheaper
+    tsc,            // Time stamp counter calibrated against CLOCK_REALTIME
+    manual          // Time set with setManualTime on the logging thread
+};
+
+namespace detail{
+
+class tscClock{
+  public:
+    inline static long long now();
+    // Raw counter, and its conversion to nanoseconds since epoch
+    inline static unsigned long long ticks();
+    inline static long long toNs(unsigned long long ticks);
+    // Nanoseconds elapsed over a number of ticks
+    inline static long long durationNs(unsigned long long ticks);
+
+  private:
+    inline tscClock();
+
+    // Anchor and rate, written under a seqlock when re-anchored
+    std::atomic<unsigned> seq_;
+    std::atomic<long long> baseNs_;
+    std::atomic<unsigned long long> baseTick_;
+    std::atomic<double> nsPerTick_;
+    std::atomic<bool> anchoring_;
+
+    inline static tscClock& get();
+    // Wall clock and the counter read as close together as possible
+    inline static void sample(long long& ns, unsigned long long& tick);
+    // Follow steps and slews of CLOCK_REALTIME, once a second
+    inline void reanchor();
+};
+
+inline long long realtimeNs(){
+#if defined(CLOCK_REALTIME) && !defined(_WIN32)
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline long long& manualNs(){
+    static thread_local long long ns = 0;
+    return ns;
+}
+
+// Nanoseconds since epoch read from the requested source
+inline long long clockNs(clockSource src){
+    switch(src){
+        case manual:
+            return manualNs();
+#ifdef CLOCK_REALTIME_COARSE
+        case realtimeCoarse:{
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+#endif
+#ifdef LL_HAS_TSC
+        case tsc:
+            return tscClock::now();
+#endif
+        default:
+            return realtimeNs();
+    }
+}
+
+#ifdef LL_HAS_TSC
+tscClock::tscClock(): seq_(0), anchoring_(false){
+    // Measure the counter against the wall clock for a few milliseconds
+    long long ns0;
+    unsigned long long tick0;
+    sample(ns0, tick0);
+    long long ns1 = ns0;
+    unsigned long long tick1 = tick0;
+    while(ns1 - ns0 < 5000000){
+        std::this_thread::yield();
+        sample(ns1, tick1);
+    }
+
+    nsPerTick_.store(static_cast<double>(ns1 - ns0) / static_cast<double>(tick1 - tick0), std::memory_order_relaxed);
+    baseNs_.store(ns1, std::memory_order_relaxed);
+    baseTick_.store(tick1, std::memory_order_relaxed);
+}
+
+void tscClock::sample(long long& ns, unsigned long long& tick){
+    // A preemption between the two reads shows as a wide gap: the
+    // narrowest of a few tries is kept
+    unsigned long long gap = ~0ULL;
+    ns = 0;
+    tick = 0;
+    for(int i = 0; i < 5; ++i){
+        const unsigned long long before = __rdtsc();
+        const long long now = realtimeNs();
+        const unsigned long long after = __rdtsc();
+        if(after - before < gap){
+            gap = after - before;
+            ns = now;
+            tick = before + gap / 2;
+        }
+    }
+}
+
+void tscClock::reanchor(){
+    if(anchoring_.exchange(true, std::memory_order_acquire)){
+        return;
+    }
+    long long ns;
+    unsigned long long tick;
+    sample(ns, tick);
+
+    const long long prevNs = baseNs_.load(std::memory_order_relaxed);
+    const unsigned long long prevTick = baseTick_.load(std::memory_order_relaxed);
+    const double prevRate = nsPerTick_.load(std::memory_order_relaxed);
+    // A rate off by more than 1% comes from a step of the wall clock, which
+    // only moves the anchor
+    const double rate = static_cast<double>(ns - prevNs) / static_cast<double>(tick - prevTick);
+    const bool keepRate = !(rate > prevRate * 0.99 && rate < prevRate * 1.01);
+
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    baseNs_.store(ns, std::memory_order_relaxed);
+    baseTick_.store(tick, std::memory_order_relaxed);
+    nsPerTick_.store(keepRate ? prevRate : rate, std::memory_order_relaxed);
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    anchoring_.store(false, std::memory_order_release);
+}
+
+long long tscClock::now(){
+    return toNs(ticks());
+}
+
+unsigned long long tscClock::ticks(){
+    return __rdtsc();
+}
+
+long long tscClock::toNs(unsigned long long ticks){
+    tscClock& clk = get();
+    long long baseNs;
+    unsigned long long baseTick;
+    double nsPerTick;
+    unsigned seq;
+    do{
+        seq = clk.seq_.load(std::memory_order_acquire);
+        baseNs = clk.baseNs_.load(std::memory_order_relaxed);
+        baseTick = clk.baseTick_.load(std::memory_order_relaxed);
+        nsPerTick = clk.nsPerTick_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }while((seq & 1) != 0 || clk.seq_.load(std::memory_order_relaxed) != seq);
+
+    const long long delta = static_cast<long long>(ticks - baseTick);
+    const long long elapsed = static_cast<long long>(static_cast<double>(delta) * nsPerTick);
+    if(elapsed > 1000000000LL){
+        clk.reanchor();
+    }
+    return baseNs + elapsed;
+}
+
+long long tscClock::durationNs(unsigned long long ticks){
+    return static_cast<long long>(static_cast<double>(ticks) * get().nsPerTick_.load(std::memory_order_relaxed));
+}
+
+tscClock& tscClock::get(){
+    static tscClock ret;
+    return ret;
+}
+#endif
+
+// Renders " %Y-%m-%d %H:%M:%S[.fraction] " into out, which must hold at
+// least 48 bytes. The calendar part is cached per thread and only
+// recomputed when the second changes. Returns the number of bytes written.
+inline size_t renderTime(char* out, long long ns, int digits){
+    struct secCache{
+        long long sec = -1;
+        size_t len = 0;
+        char text[32];
+    };
+    static thread_local secCache cache;
+
+    long long sec = ns / 1000000000LL;
+    long long frac = ns % 1000000000LL;
+    if(frac < 0){
+        --sec;
+        frac += 1000000000LL;
+    }
+
+    if(sec != cache.sec){
+        std::time_t t = static_cast<std::time_t>(sec);
+        std::tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &t);
+#else
+        localtime_r(&t, &tm);
+#endif
+        cache.len = std::strftime(cache.text, sizeof(cache.text), " %Y-%m-%d %H:%M:%S", &tm);
+        cache.sec = sec;
+    }
+
+    size_t len = cache.len;
+    std::memcpy(out, cache.text, len);
+    if(digits > 0){
+        out[len] = '.';
+        for(int i = 9; i > digits; --i){
+            frac /= 10;
+        }
+        for(int i = digits; i > 0; --i){
+            out[len + i] = static_cast<char>('0' + frac % 10);
+            frac /= 10;
+        }
+        len += digits + 1;
+    }
+    out[len++] = ' ';
+
+    return len;
+}
+
+} // namespace detail
+
+// Timestamp used by formats reading the ll::manual clock on this thread,
+// e.g. to render lines recorded earlier with their original time
+inline void setManualTime(long long ns){
+    detail::manualNs() = ns;
+}
+
+}
@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace ll{
+
+namespace detail{
+
+// Uids of the llogger objects alive, so that threads can drop what they
+// keep for those destroyed since
+class liveUids{
+  public:
+    inline static liveUids& global();
+
+    inline void add(unsigned long long uid);
+    inline void remove(unsigned long long uid);
+    // Erase the entries of map keyed by a uid no longer alive
+    template<typename Map>
+    inline void prune(Map& map);
+
+  private:
+    std::mutex mtx_;
+    std::unordered_set<unsigned long long> uids_;
+};
+
+liveUids& liveUids::global(){
+    static liveUids ret;
+    return ret;
+}
+
+void liveUids::add(unsigned long long uid){
+    std::lock_guard<std::mutex> lk(mtx_);
+    uids_.insert(uid);
+}
+
+void liveUids::remove(unsigned long long uid){
+    std::lock_guard<std::mutex> lk(mtx_);
+    uids_.erase(uid);
+}
+
+template<typename Map>
+void liveUids::prune(Map& map){
+    std::lock_guard<std::mutex> lk(mtx_);
+    for(auto it = map.begin(); it != map.end();){
+        if(uids_.count(it->first) == 0){
+            it = map.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+// Values a thread keeps per llogger. Entries of destroyed loggers are
+// dropped whenever the map doubled since it was last pruned, so that it
+// holds at most about twice as many entries as live loggers it used.
+// References stay valid until the entry is dropped.
+template<typename T>
+class uidMap{
+  public:
+    template<typename... Args>
+    inline T& get(unsigned long long uid, Args&&... args);
+
+  private:
+    std::unordered_map<unsigned long long, T> all_;
+    size_t pruneAt_ = 16;
+};
+
+template<typename T>
+template<typename... Args>
+T& uidMap<T>::get(unsigned long long uid, Args&&... args){
+    auto it = all_.find(uid);
+    if(it != all_.end()){
+        return it->second;
+    }
+    if(all_.size() >= pruneAt_){
+        liveUids::global().prune(all_);
+        pruneAt_ = all_.size() * 2 > 16 ? all_.size() * 2 : 16;
+    }
+    return all_.emplace(std::piecewise_construct, std::forward_as_tuple(uid),
+                        std::forward_as_tuple(std::forward<Args>(args)...)).first->second;
+}
+
+} // namespace detail
+
+}
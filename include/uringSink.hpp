@@ -0,0 +1,700 @@
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(LL_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define LL_HAS_IO_URING 1
+#endif
+#endif
+
+#include "fileIo.hpp"
+#include "lldefs.h"
+#include "metrics.hpp"
+#include "osSync.hpp"
+
+namespace ll{
+
+namespace detail{
+
+#ifdef LL_HAS_IO_URING
+
+// Submission and completion queues of an io_uring, set up with the system
+// calls rather than liburing. Not thread safe.
+class uring{
+  public:
+    uring() = default;
+    uring(const uring&) = delete;
+    inline ~uring();
+
+    // False where the kernel or a seccomp filter refuses io_uring
+    inline bool open(unsigned entries);
+    inline bool valid() const;
+
+    // Cleared entry at the tail of the submission queue, nullptr if full.
+    // The kernel reads it on the next enter().
+    inline io_uring_sqe* next();
+    // Submit the queued entries, and wait for wait completions
+    inline bool enter(unsigned wait);
+    // Wait for a completion without submitting anything, which another
+    // thread may do meanwhile
+    inline bool wait();
+    inline unsigned pending() const;
+    // Pass every completion to f(user_data, res), returns how many
+    template<typename Fn>
+    inline unsigned reap(Fn&& f);
+
+    inline bool registerBuffers(const iovec* iov, unsigned count);
+    inline bool registerFile(int fd);
+
+  private:
+    int fd_ = -1;
+    void* sqMap_ = MAP_FAILED;
+    size_t sqMapLen_ = 0;
+    void* cqMap_ = MAP_FAILED;
+    size_t cqMapLen_ = 0;
+    void* sqeMap_ = MAP_FAILED;
+    size_t sqeMapLen_ = 0;
+
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    // Queued but not yet submitted
+    unsigned pending_ = 0;
+};
+
+uring::~uring(){
+    if(sqeMap_ != MAP_FAILED){
+        munmap(sqeMap_, sqeMapLen_);
+    }
+    if(cqMap_ != MAP_FAILED && cqMap_ != sqMap_){
+        munmap(cqMap_, cqMapLen_);
+    }
+    if(sqMap_ != MAP_FAILED){
+        munmap(sqMap_, sqMapLen_);
+    }
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+bool uring::open(unsigned entries){
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if(fd_ < 0){
+        return false;
+    }
+
+    sqMapLen_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqMapLen_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single){
+        sqMapLen_ = cqMapLen_ = sqMapLen_ > cqMapLen_ ? sqMapLen_ : cqMapLen_;
+    }
+#endif
+    sqMap_ = mmap(nullptr, sqMapLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cqMap_ = single ? sqMap_ : mmap(nullptr, cqMapLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    fd_, IORING_OFF_CQ_RING);
+    sqeMapLen_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqeMap_ = mmap(nullptr, sqeMapLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if(sqMap_ == MAP_FAILED || cqMap_ == MAP_FAILED || sqeMap_ == MAP_FAILED){
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqMap_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_entries);
+    sqes_ = static_cast<io_uring_sqe*>(sqeMap_);
+
+    char* cq = static_cast<char*>(cqMap_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool uring::valid() const{
+    return sqes_ != nullptr;
+}
+
+io_uring_sqe* uring::next(){
+    const unsigned tail = *sqTail_;
+    if(tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_){
+        return nullptr;
+    }
+    const unsigned idx = tail & sqMask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++pending_;
+    return sqe;
+}
+
+bool uring::enter(unsigned wait){
+    const unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for(;;){
+        long ret = syscall(__NR_io_uring_enter, fd_, pending_, wait, flags, nullptr, 0);
+        if(ret >= 0){
+            pending_ -= static_cast<unsigned>(ret) < pending_ ? static_cast<unsigned>(ret) : pending_;
+            return true;
+        }
+        if(errno != EINTR){
+            return false;
+        }
+    }
+}
+
+bool uring::wait(){
+    for(;;){
+        long ret = syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(ret >= 0){
+            return true;
+        }
+        if(errno != EINTR){
+            return false;
+        }
+    }
+}
+
+unsigned uring::pending() const{
+    return pending_;
+}
+
+template<typename Fn>
+unsigned uring::reap(Fn&& f){
+    unsigned head = *cqHead_;
+    const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    const unsigned ret = tail - head;
+    for(; head != tail; ++head){
+        const io_uring_cqe& cqe = cqes_[head & cqMask_];
+        f(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return ret;
+}
+
+bool uring::registerBuffers(const iovec* iov, unsigned count){
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iov, count) == 0;
+}
+
+bool uring::registerFile(int fd){
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, &fd, 1) == 0;
+}
+
+#endif
+
+} // namespace detail
+
+// Linux backend handing file writes to the kernel through io_uring, so
+// that no thread blocks in write(2) or fdatasync. Lines are collected in
+// buffers registered with the ring. A full buffer is submitted as one
+// write at its offset in the file, without waiting for it, and the next
+// buffer is filled meanwhile. Completions are reaped in batches whenever
+// a buffer is submitted or needed. A thread waiting for a free buffer
+// waits with the mutex released, so that the others keep logging into
+// the current buffer if it has room. A timer thread submits lines pending
+// for longer than the policy interval, and an fdatasync ordered after the
+// writes every syncInterval.
+//
+// Where io_uring is missing at build time or refused at runtime, full
+// buffers are written by the logging thread with pwritev instead.
+// usesUring() tells which path is taken. The file must have no other
+// writer.
+class UringSink{
+  public:
+    // The policy gives the buffer size, the longest time a line waits in
+    // a buffer, and the level submitting the buffer at once
+    inline UringSink(const std::string& path,
+                     const flushPolicy& policy = flushPolicy(1 << 16, std::chrono::milliseconds(100), error),
+                     std::chrono::milliseconds syncInterval = std::chrono::seconds(1),
+                     size_t buffers = 4);
+    UringSink(const UringSink&) = delete;
+    inline ~UringSink();
+
+    inline void log(const std::string& str, level lev);
+    // Write every pending line and wait until they reached the disk
+    inline void flush();
+    inline bool usesUring() const;
+    inline unsigned long long errors() const;
+
+  private:
+    struct buffer{
+        char* data;
+        size_t len;
+        // Where an in flight buffer goes, and how much of it was written
+        uint64_t offset;
+        size_t done;
+        bool busy;
+        iovec iov;
+    };
+
+    const std::string path_;
+    const flushPolicy policy_;
+    const std::chrono::milliseconds syncInterval_;
+    const size_t capacity_;
+    int fd_;
+    // End of the file once every submitted buffer is written
+    uint64_t offset_;
+    std::atomic<unsigned long long> errors_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unique_ptr<char[]> storage_;
+    std::vector<buffer> buffers_;
+    // Buffer taking lines, busy only until a thread waiting for a free
+    // buffer got one
+    size_t current_;
+    std::chrono::steady_clock::time_point opened_;
+    size_t inFlight_;
+    // Bytes written since the last fdatasync was submitted
+    bool dirty_;
+    bool syncing_;
+    bool stop_;
+    // A thread waits for completions without the mutex, and is the only
+    // one reaping them until it took it back
+    bool reaping_;
+    std::condition_variable reaped_;
+    // Buffers in flight at once
+    detail::queueGauge depth_;
+#ifdef LL_HAS_IO_URING
+    detail::uring ring_;
+    bool fixedBuffers_;
+    bool fixedFile_;
+#endif
+    std::thread timer_;
+
+    // Queue the current buffer and take another one
+    inline void submit(std::unique_lock<std::mutex>& lk);
+    inline void queueWrite(size_t idx);
+    inline void completed(uint64_t idx, int res);
+    // Submit the queued entries and reap the completions there are
+    inline void reap();
+    // Wait for a completion, or for the thread waiting for one to reap.
+    // Called with something in flight.
+    inline void awaitCompletion(std::unique_lock<std::mutex>& lk);
+    // Make current_ a buffer that is not in flight, waiting for one if
+    // they all are. Memory stays bounded when the disk falls behind.
+    inline void acquire(std::unique_lock<std::mutex>& lk);
+    inline void sync(std::unique_lock<std::mutex>& lk);
+    inline void writeLarge(const std::string& str, std::unique_lock<std::mutex>& lk);
+    inline void run();
+#ifdef LL_HAS_IO_URING
+    // Entry of the submission queue, nullptr if the ring refuses more
+    inline io_uring_sqe* nextSqe();
+#endif
+};
+
+UringSink::UringSink(const std::string& path,
+                     const flushPolicy& policy,
+                     std::chrono::milliseconds syncInterval,
+                     size_t buffers): path_(path),
+                                      policy_(policy),
+                                      syncInterval_(syncInterval),
+                                      capacity_(policy.bytes > 4096 ? policy.bytes : 4096),
+                                      fd_(-1),
+                                      offset_(0),
+                                      errors_(0),
+                                      storage_(new char[capacity_ * (buffers > 2 ? buffers : 2)]),
+                                      current_(0),
+                                      inFlight_(0),
+                                      dirty_(false),
+                                      syncing_(false),
+                                      stop_(false),
+                                      reaping_(false),
+                                      depth_(path_, buffers > 2 ? buffers : 2){
+    buffers_.resize(buffers > 2 ? buffers : 2);
+    for(size_t i = 0; i < buffers_.size(); ++i){
+        buffer& b = buffers_[i];
+        b.data = storage_.get() + i * capacity_;
+        b.len = 0;
+        b.offset = 0;
+        b.done = 0;
+        b.busy = false;
+        b.iov.iov_base = b.data;
+        b.iov.iov_len = capacity_;
+    }
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    const off_t end = fd_ >= 0 ? ::lseek(fd_, 0, SEEK_END) : -1;
+    if(end < 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }else{
+        offset_ = static_cast<uint64_t>(end);
+    }
+
+#ifdef LL_HAS_IO_URING
+    fixedBuffers_ = false;
+    fixedFile_ = false;
+    // Room for a write per buffer and an fdatasync
+    unsigned entries = 4;
+    while(entries < buffers_.size() + 1){
+        entries <<= 1;
+    }
+    if(fd_ >= 0 && ring_.open(entries)){
+        std::vector<iovec> iov(buffers_.size());
+        for(size_t i = 0; i < buffers_.size(); ++i){
+            iov[i] = buffers_[i].iov;
+        }
+        // Registration fails over RLIMIT_MEMLOCK on older kernels
+        fixedBuffers_ = ring_.registerBuffers(iov.data(), static_cast<unsigned>(iov.size()));
+        fixedFile_ = ring_.registerFile(fd_);
+    }
+#endif
+
+    if(policy_.interval.count() > 0 || syncInterval_.count() > 0){
+        timer_ = std::thread(&UringSink::run, this);
+    }
+}
+
+UringSink::~UringSink(){
+    if(timer_.joinable()){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+    }
+    flush();
+
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+void UringSink::log(const std::string& str, level lev){
+    std::unique_lock<std::mutex> lk(mtx_);
+    const size_t len = str.size() + 1;
+    if(len > capacity_){
+        writeLarge(str, lk);
+        return;
+    }
+
+    // Other threads may fill the buffer while this one waits for another
+    acquire(lk);
+    while(buffers_[current_].len + len > capacity_){
+        submit(lk);
+    }
+    buffer& b = buffers_[current_];
+    if(b.len == 0){
+        opened_ = std::chrono::steady_clock::now();
+    }
+    std::memcpy(b.data + b.len, str.data(), str.size());
+    b.data[b.len + str.size()] = '\n';
+    b.len += len;
+
+    if(b.len >= policy_.bytes || lev <= policy_.immediate){
+        submit(lk);
+    }
+}
+
+void UringSink::flush(){
+    std::unique_lock<std::mutex> lk(mtx_);
+    submit(lk);
+    while(inFlight_ > 0){
+        awaitCompletion(lk);
+    }
+    sync(lk);
+#ifdef LL_HAS_IO_URING
+    while(syncing_){
+        awaitCompletion(lk);
+    }
+#endif
+}
+
+bool UringSink::usesUring() const{
+#ifdef LL_HAS_IO_URING
+    return ring_.valid();
+#else
+    return false;
+#endif
+}
+
+unsigned long long UringSink::errors() const{
+    return errors_.load(std::memory_order_relaxed);
+}
+
+void UringSink::submit(std::unique_lock<std::mutex>& lk){
+    buffer& b = buffers_[current_];
+    if(b.len == 0 || b.busy){
+        return;
+    }
+    b.offset = offset_;
+    b.done = 0;
+    offset_ += b.len;
+    dirty_ = true;
+
+    if(!usesUring()){
+        iovec iov{b.data, b.len};
+        if(fd_ < 0 || !detail::writeAllv(fd_, &iov, 1, static_cast<int64_t>(b.offset))){
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        b.len = 0;
+        return;
+    }
+
+    b.busy = true;
+    depth_.update(++inFlight_);
+    queueWrite(current_);
+    reap();
+    acquire(lk);
+}
+
+void UringSink::queueWrite(size_t idx){
+#ifdef LL_HAS_IO_URING
+    buffer& b = buffers_[idx];
+    io_uring_sqe* sqe = nextSqe();
+    if(sqe == nullptr){
+        // Written in place when the ring refuses it
+        iovec iov{b.data + b.done, b.len - b.done};
+        const bool written = fd_ >= 0 && detail::writeAllv(fd_, &iov, 1, static_cast<int64_t>(b.offset + b.done));
+        completed(idx, written ? static_cast<int>(b.len - b.done) : -EIO);
+        return;
+    }
+    sqe->fd = fixedFile_ ? 0 : fd_;
+    sqe->flags = fixedFile_ ? IOSQE_FIXED_FILE : 0;
+    sqe->off = b.offset + b.done;
+    sqe->user_data = idx;
+    if(fixedBuffers_){
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uintptr_t>(b.data + b.done);
+        sqe->len = static_cast<unsigned>(b.len - b.done);
+        sqe->buf_index = static_cast<uint16_t>(idx);
+    }else{
+        sqe->opcode = IORING_OP_WRITEV;
+        b.iov.iov_base = b.data + b.done;
+        b.iov.iov_len = b.len - b.done;
+        sqe->addr = reinterpret_cast<uintptr_t>(&b.iov);
+        sqe->len = 1;
+    }
+#else
+    (void)idx;
+#endif
+}
+
+void UringSink::completed(uint64_t idx, int res){
+    if(idx == buffers_.size()){
+        syncing_ = false;
+        if(res == -ECANCELED){
+            dirty_ = true;
+        }else if(res < 0){
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    buffer& b = buffers_[idx];
+    // Requests of a thread that exited are cancelled, or fail to reach
+    // its address space, before they ran: the buffer is still valid
+    if(res == -EINTR || res == -EAGAIN || res == -ECANCELED || res == -EFAULT){
+        queueWrite(idx);
+        return;
+    }
+    if(res > 0){
+        b.done += static_cast<size_t>(res);
+        // Short writes only happen on errors such as a full disk
+        if(b.done < b.len){
+            queueWrite(idx);
+            return;
+        }
+    }else{
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    b.busy = false;
+    b.len = 0;
+    --inFlight_;
+}
+
+void UringSink::reap(){
+#ifdef LL_HAS_IO_URING
+    if(!ring_.valid()){
+        return;
+    }
+    if(ring_.pending() > 0 && !ring_.enter(0)){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Completions are left to the waiting thread, which counts on them
+    if(reaping_){
+        return;
+    }
+    ring_.reap([this](uint64_t idx, int res){
+        completed(idx, res);
+    });
+    // Writes queued again by completions
+    if(ring_.pending() > 0 && !ring_.enter(0)){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+}
+
+void UringSink::awaitCompletion(std::unique_lock<std::mutex>& lk){
+#ifdef LL_HAS_IO_URING
+    if(!ring_.valid()){
+        return;
+    }
+    if(reaping_){
+        reaped_.wait(lk);
+        return;
+    }
+
+    reaping_ = true;
+    if(ring_.pending() > 0 && !ring_.enter(0)){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    lk.unlock();
+    const bool ok = ring_.wait();
+    lk.lock();
+    reaping_ = false;
+    if(!ok){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    reap();
+    reaped_.notify_all();
+#else
+    (void)lk;
+#endif
+}
+
+void UringSink::acquire(std::unique_lock<std::mutex>& lk){
+    while(buffers_[current_].busy){
+        for(size_t i = 0; i < buffers_.size(); ++i){
+            if(!buffers_[i].busy){
+                current_ = i;
+                return;
+            }
+        }
+        awaitCompletion(lk);
+    }
+}
+
+void UringSink::sync(std::unique_lock<std::mutex>& lk){
+    if(!dirty_ || fd_ < 0){
+        return;
+    }
+#ifdef LL_HAS_IO_URING
+    if(ring_.valid()){
+        if(syncing_){
+            return;
+        }
+        // Drained: starts once the writes submitted before it completed
+        io_uring_sqe* sqe = nextSqe();
+        if(sqe != nullptr){
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = fixedFile_ ? 0 : fd_;
+            sqe->flags = IOSQE_IO_DRAIN | (fixedFile_ ? IOSQE_FIXED_FILE : 0);
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            sqe->user_data = buffers_.size();
+            syncing_ = true;
+            dirty_ = false;
+            reap();
+            return;
+        }
+        // Refused by the ring: left to the next sync while writes are in
+        // flight, as fdatasync would not cover them
+        if(inFlight_ > 0){
+            return;
+        }
+    }
+#endif
+    dirty_ = false;
+    lk.unlock();
+    if(fdatasync(fd_) != 0){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    lk.lock();
+}
+
+void UringSink::writeLarge(const std::string& str, std::unique_lock<std::mutex>& lk){
+    // Longer than a buffer: written in place once the buffers before it are
+    submit(lk);
+    while(inFlight_ > 0){
+        awaitCompletion(lk);
+    }
+    char newline = '\n';
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(str.data());
+    iov[0].iov_len = str.size();
+    iov[1].iov_base = &newline;
+    iov[1].iov_len = 1;
+    if(fd_ < 0 || !detail::writeAllv(fd_, iov, 2, static_cast<int64_t>(offset_))){
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    offset_ += str.size() + 1;
+    dirty_ = true;
+}
+
+#ifdef LL_HAS_IO_URING
+io_uring_sqe* UringSink::nextSqe(){
+    io_uring_sqe* sqe = ring_.next();
+    if(sqe == nullptr){
+        // Full of entries the kernel did not take yet, such as writes
+        // queued again by completions
+        if(!ring_.enter(0)){
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        sqe = ring_.next();
+    }
+    return sqe;
+}
+#endif
+
+void UringSink::run(){
+    using namespace std::chrono;
+    milliseconds tick = policy_.interval.count() > 0 ? policy_.interval : syncInterval_;
+    if(syncInterval_.count() > 0 && syncInterval_ < tick){
+        tick = syncInterval_;
+    }
+    steady_clock::time_point lastSync = steady_clock::now();
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    while(!stop_){
+        cv_.wait_for(lk, tick);
+        if(stop_){
+            break;
+        }
+        const steady_clock::time_point now = steady_clock::now();
+        reap();
+        if(policy_.interval.count() > 0 && buffers_[current_].len > 0 && now - opened_ >= policy_.interval){
+            submit(lk);
+        }
+        if(syncInterval_.count() > 0 && now - lastSync >= syncInterval_){
+            lastSync = now;
+            sync(lk);
+        }
+    }
+}
+
+}
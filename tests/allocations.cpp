@@ -0,0 +1,125 @@
+// Logging a line allocates nothing once the thread has logged one as long
+// before: global operator new is replaced by one counting the calls made
+// while a test runs.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <string>
+
+#include "llogger.h"
+
+namespace{
+
+std::atomic<bool> counting(false);
+std::atomic<unsigned long long> allocs(0);
+
+void* allocate(size_t size){
+    if(counting.load(std::memory_order_relaxed)){
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* ret = std::malloc(size != 0 ? size : 1);
+    if(ret == nullptr){
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+struct nullSink{
+    unsigned long long lines = 0;
+
+    void log(const std::string& str){
+        lines += str.empty() ? 0 : 1;
+    }
+};
+
+struct point{
+    int x;
+    int y;
+};
+
+std::ostream& operator << (std::ostream& os, const point& p){
+    return os << '(' << p.x << ", " << p.y << ')';
+}
+
+// Allocations made by 1000 calls of body after a few untimed ones
+template<typename Body>
+unsigned long long allocsOf(Body&& body){
+    for(int i = 0; i < 16; ++i){
+        body(i);
+    }
+    allocs.store(0);
+    counting.store(true);
+    for(int i = 0; i < 1000; ++i){
+        body(i);
+    }
+    counting.store(false);
+    return allocs.load();
+}
+
+} // namespace
+
+void* operator new(size_t size){
+    return allocate(size);
+}
+
+void* operator new[](size_t size){
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept{
+    std::free(p);
+}
+
+int main(){
+    nullSink sink;
+    ll::llogger<nullSink> logger(ll::debug, sink);
+    int failed = 0;
+
+    const unsigned long long fast = allocsOf([&](int i){
+        logger(ll::info) << "request " << i << " took " << 1.5 << " ms from " << std::string("client");
+    });
+    const unsigned long long stream = allocsOf([&](int i){
+        logger(ll::info) << "moved to " << point{i, -i};
+    });
+    const unsigned long long filtered = allocsOf([&](int i){
+        logger(ll::info, i < 0) << "never " << i;
+    });
+    // Past the inline capacity: the string kept by the thread has grown
+    // during the untimed calls and is reused
+    const std::string payload(1000, 'x');
+    const unsigned long long longLines = allocsOf([&](int i){
+        logger(ll::info) << "payload " << i << ' ' << payload << " moved to " << point{i, -i};
+    });
+
+    const struct{
+        const char* name;
+        unsigned long long allocs;
+    } results[] = {{"fast path", fast}, {"operator <<", stream}, {"filtered", filtered},
+                  {"long lines", longLines}};
+    for(const auto& r: results){
+        if(r.allocs != 0){
+            std::fprintf(stderr, "%s: %llu allocations over 1000 lines\n", r.name, r.allocs);
+            failed = 1;
+        }
+    }
+    if(sink.lines != 3 * 1016){
+        std::fprintf(stderr, "%llu lines written, expected %d\n", sink.lines, 3 * 1016);
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,137 @@
+// BinLog statements of every argument type, from several threads, decoded
+// back by BinDecoder and, when its path is given, by the lldecode tool.
+//   binLog [lldecode]
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "binLog.hpp"
+
+namespace{
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+struct statement{
+    ll::level lev;
+    long long ns;
+    std::string text;
+};
+
+const int threads = 4;
+const int perThread = 2000;
+
+std::string threadLine(int t, int i){
+    return "thread " + std::to_string(t) + " statement " + std::to_string(i);
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    const std::string path = "/tmp/llBinLog." + std::to_string(getpid());
+    static const ll::bfmt<bool, char, int8_t, uint8_t, int> small("{} {} {} {} {}");
+    static const ll::bfmt<long long, unsigned long long, double> wide("{} {} {}");
+    static const ll::bfmt<const char*, std::string, const void*> strings("[{}] [{}] {}");
+    static const ll::bfmt<int, int> perThreadFmt("thread {} statement {}");
+
+    const long long before = ll::detail::realtimeNs();
+    {
+        ll::BinLog blog(path, ll::info, 1 << 12);
+        blog(ll::warning, small, true, 'x', static_cast<int8_t>(-128), static_cast<uint8_t>(255), -7);
+        blog(ll::info, wide, std::numeric_limits<long long>::min(), std::numeric_limits<unsigned long long>::max(), 0.5);
+        blog(ll::error, strings, "literal", std::string("with {} inside"), static_cast<const void*>(nullptr));
+        // Filtered by the level of the log
+        blog(ll::debug, small, false, 'y', static_cast<int8_t>(1), static_cast<uint8_t>(2), 3);
+
+        // Buffers of 4 KiB wrap many times over
+        std::vector<std::thread> ts;
+        for(int t = 0; t < threads; ++t){
+            ts.emplace_back([&blog, t]{
+                for(int i = 0; i < perThread; ++i){
+                    blog(ll::info, perThreadFmt, t, i);
+                }
+            });
+        }
+        for(std::thread& t: ts){
+            t.join();
+        }
+        blog.flush();
+        check(blog.errors() == 0, "errors while logging", std::to_string(blog.errors()));
+    }
+    const long long after = ll::detail::realtimeNs();
+
+    std::vector<statement> got;
+    ll::BinDecoder decoder(path);
+    check(decoder.good(), "not a binary log");
+    const bool ok = decoder.forEach([&got](ll::level lev, long long ns, const std::string& text){
+        got.push_back({lev, ns, text});
+    });
+    check(ok, "truncated or corrupt");
+
+    check(got.size() == 3 + threads * perThread, "statements decoded", std::to_string(got.size()));
+    if(got.size() >= 3){
+        check(got[0].lev == ll::warning && got[0].text == "1 x -128 255 -7", "small types", got[0].text);
+        check(got[1].lev == ll::info && got[1].text == "-9223372036854775808 18446744073709551615 0.5",
+              "wide types", got[1].text);
+        check(got[2].lev == ll::error && got[2].text.compare(0, 27, "[literal] [with {} inside] ") == 0,
+              "strings", got[2].text);
+    }
+    // Each thread's statements stay in order, within the time logged
+    std::vector<int> next(threads, 0);
+    for(size_t i = 3; i < got.size(); ++i){
+        int t = -1;
+        int n = -1;
+        if(std::sscanf(got[i].text.c_str(), "thread %d statement %d", &t, &n) != 2 || t < 0 || t >= threads ||
+           got[i].text != threadLine(t, n)){
+            check(false, "unexpected statement", got[i].text);
+            break;
+        }
+        if(n != next[t]++){
+            check(false, "statement out of order", got[i].text);
+            break;
+        }
+        if(got[i].ns < before || got[i].ns > after){
+            check(false, "time outside of the run", got[i].text);
+            break;
+        }
+    }
+
+    // lldecode renders the same statements with the default format
+    if(argc > 1){
+        const std::string cmd = std::string(argv[1]) + " " + path;
+        FILE* pipe = popen(cmd.c_str(), "r");
+        check(pipe != nullptr, "cannot run lldecode", cmd);
+        size_t lines = 0;
+        char buf[512];
+        while(pipe != nullptr && std::fgets(buf, sizeof(buf), pipe) != nullptr){
+            std::string line(buf);
+            if(!line.empty() && line.back() == '\n'){
+                line.pop_back();
+            }
+            if(lines < got.size()){
+                const std::string& text = got[lines].text;
+                if(line.size() < text.size() || line.compare(line.size() - text.size(), text.size(), text) != 0){
+                    check(false, "lldecode line differs", line);
+                }
+            }
+            ++lines;
+        }
+        check(pipe != nullptr && pclose(pipe) == 0, "lldecode failed");
+        check(lines == got.size(), "lldecode lines", std::to_string(lines));
+    }
+
+    unlink(path.c_str());
+    return failed;
+}
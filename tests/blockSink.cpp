@@ -0,0 +1,164 @@
+// Round trips of the LZ codec, and BlockSink files read back by BlockReader
+// whole and by time range, after a torn last block and without an index.
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "blockSink.hpp"
+
+namespace{
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+// Compress src and decompress it back. Returns the compressed size, 0 if
+// the codec kept it as is.
+size_t roundTrip(const std::string& src, const char* what){
+    ll::detail::lzCodec lz;
+    std::string packed;
+    const size_t len = lz.compress(src.data(), src.size(), packed);
+    if(len == 0){
+        return 0;
+    }
+    check(len < src.size(), what, "compressed to " + std::to_string(len) + " of " + std::to_string(src.size()));
+    std::string back(src.size(), '\0');
+    check(ll::detail::lzCodec::decompress(packed.data(), len, &back[0], back.size()) && back == src, what,
+          "decompressed bytes differ");
+    // A wrong length is refused rather than overrun
+    std::string shorter(src.size() - 1, '\0');
+    check(!ll::detail::lzCodec::decompress(packed.data(), len, &shorter[0], shorter.size()), what,
+          "decompressed into a shorter buffer");
+    return len;
+}
+
+void testCodec(){
+    std::mt19937 rng(42);
+    std::string noise(1 << 16, '\0');
+    for(char& c: noise){
+        c = static_cast<char>(rng());
+    }
+    check(roundTrip(noise, "incompressible") == 0, "incompressible input compressed");
+
+    std::string lines;
+    for(int i = 0; lines.size() < (1 << 18); ++i){
+        lines += "[2026-10-17 12:00:00.123] INFO : request " + std::to_string(i) + " served in 1.5 ms\n";
+    }
+    check(roundTrip(lines, "repetitive") != 0, "repetitive input kept as is");
+    check(roundTrip(std::string(100000, 'a'), "run") != 0, "run kept as is");
+
+    // Matches overlapping their own output, at offsets shorter than them
+    for(size_t period = 1; period <= 8; ++period){
+        std::string src;
+        for(size_t i = 0; i < 4096; ++i){
+            src.push_back(static_cast<char>('a' + i % period));
+        }
+        src += noise.substr(0, 64) + src.substr(0, 300);
+        const std::string what = "overlapping matches of period " + std::to_string(period);
+        check(roundTrip(src, what.c_str()) != 0, what.c_str(), "kept as is");
+    }
+
+    // Inputs too short to hold a match
+    for(size_t len = 1; len < 24; ++len){
+        roundTrip(std::string(len, 'x'), "short input");
+    }
+}
+
+struct group{
+    long long fromNs;
+    long long toNs;
+    std::vector<std::string> lines;
+};
+
+// Log a group of lines into a block of its own
+group logGroup(ll::BlockSink& sink, int id){
+    group ret;
+    ret.fromNs = ll::detail::realtimeNs();
+    for(int i = 0; i < 500; ++i){
+        ret.lines.push_back("group " + std::to_string(id) + " line " + std::to_string(i) + " of a block");
+        sink.log(ret.lines.back(), ll::info);
+    }
+    sink.flush();
+    ret.toNs = ll::detail::realtimeNs();
+    // Blocks of later groups start strictly after this one ends
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    return ret;
+}
+
+std::vector<std::string> readLines(ll::BlockReader& reader, long long fromNs, long long toNs, size_t& bad){
+    std::vector<std::string> ret;
+    bad = reader.forEach(fromNs, toNs, [&ret](const char* line, size_t len){
+        ret.emplace_back(line, len);
+    });
+    return ret;
+}
+
+void testSink(ll::blockCodec codec, const std::string& path){
+    const std::string name = "codec " + std::to_string(static_cast<int>(codec));
+    unlink(path.c_str());
+    unlink((path + ".idx").c_str());
+
+    std::vector<group> groups;
+    {
+        ll::BlockSink sink(path, ll::flushPolicy(1 << 20, std::chrono::milliseconds(0), ll::fatal), codec);
+        for(int id = 0; id < 3; ++id){
+            groups.push_back(logGroup(sink, id));
+        }
+        check(sink.errors() == 0, "errors while writing", name);
+    }
+
+    // Tear the last block as a crash in the middle of its write would
+    struct stat st;
+    check(stat(path.c_str(), &st) == 0 && truncate(path.c_str(), st.st_size - 7) == 0, "cannot truncate", path);
+    groups.pop_back();
+    {
+        ll::BlockSink sink(path, ll::flushPolicy(1 << 20, std::chrono::milliseconds(0), ll::fatal), codec);
+        groups.push_back(logGroup(sink, 3));
+        check(sink.errors() == 0, "errors after reopening", name);
+    }
+
+    std::vector<std::string> all;
+    for(const group& g: groups){
+        all.insert(all.end(), g.lines.begin(), g.lines.end());
+    }
+    for(int pass = 0; pass < 2; ++pass){
+        // The second pass rebuilds the index from the data file
+        const std::string what = name + (pass == 0 ? " with its index" : " without an index");
+        ll::BlockReader reader(path);
+        check(reader.good() && reader.blocks().size() == groups.size(), "blocks", what);
+
+        size_t bad = 0;
+        check(readLines(reader, INT64_MIN, INT64_MAX, bad) == all && bad == 0, "lines read back", what);
+        for(size_t i = 0; i < groups.size(); ++i){
+            const std::vector<std::string> got = readLines(reader, groups[i].fromNs, groups[i].toNs, bad);
+            check(got == groups[i].lines && bad == 0, "lines of a time range", what + ", group " + std::to_string(i));
+        }
+        check(readLines(reader, groups[0].toNs + 1, groups[1].fromNs - 1, bad).empty(), "lines between blocks", what);
+        check(readLines(reader, groups.back().toNs + 1, INT64_MAX, bad).empty(), "lines after the last block", what);
+
+        unlink((path + ".idx").c_str());
+    }
+    unlink(path.c_str());
+}
+
+} // namespace
+
+int main(){
+    testCodec();
+    const std::string path = "/tmp/llBlockSink." + std::to_string(getpid());
+    for(ll::blockCodec codec: {ll::storeBlocks, ll::lzBlocks, ll::zlibBlocks}){
+        testSink(codec, path);
+    }
+    return failed;
+}
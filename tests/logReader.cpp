@@ -0,0 +1,219 @@
+// Time range and level queries of LogReader, and of llquery when its path
+// is given, against a scan of every line. The log is written by a llogger
+// through OStreamSync with times set by hand, out of order in places, and
+// multi-line messages whose continuations end up at chunk boundaries.
+//   logReader [llquery]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "llogger.h"
+#include "logReader.hpp"
+
+namespace{
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+const long long second = 1000000000LL;
+// 2023-11-14, far from any clock change
+const long long base = 1700000000LL * second;
+
+struct record{
+    long long ns;
+    ll::level lev;
+    std::string text;
+};
+
+// Log count messages starting at start, in time order but for one message
+// in 40 that goes back up to 2 s and a run of 200 an hour earlier
+void writeLog(const std::string& path, const ll::llfmt& format, long long start, int count, std::mt19937& rng){
+    std::ofstream out(path, std::ios::app);
+    ll::OStreamSync sync(out, ll::flushPolicy(1 << 16));
+    ll::llogger<ll::OStreamSync> logger(ll::debug, sync, format);
+
+    long long ns = start;
+    for(int i = 0; i < count; ++i){
+        ns += static_cast<long long>(rng() % 3000000);
+        long long at = ns;
+        if(i % 40 == 39){
+            at -= static_cast<long long>(rng() % (2 * second));
+        }else if(i >= count / 2 && i < count / 2 + 200){
+            at -= 3600 * second;
+        }
+        ll::setManualTime(at);
+        const ll::level lev = static_cast<ll::level>(rng() % ll::levels);
+        switch(rng() % 8){
+            case 0:
+                logger(lev) << "message " << i << " spanning\n  a second line\n  and a third";
+                break;
+            case 1:
+                logger(lev) << "message " << i << " with a long payload " << std::string(rng() % 400, 'x');
+                break;
+            default:
+                logger(lev) << "message " << i;
+                break;
+        }
+    }
+}
+
+// Every line of the file with the time and level LogReader gives it, from
+// the first line parsed on
+std::vector<record> scan(const std::string& path, const ll::llfmt& format){
+    std::vector<record> ret;
+    ll::lineParser parser(format);
+    std::ifstream in(path);
+    std::string line;
+    long long ns = 0;
+    ll::level lev = ll::info;
+    bool parsed = false;
+    while(std::getline(in, line)){
+        parsed = parser.parse(line.data(), line.size(), ns, lev) || parsed;
+        if(parsed){
+            ret.push_back(record{ns, lev, line});
+        }
+    }
+    return ret;
+}
+
+std::vector<std::string> expected(const std::vector<record>& all, long long from, long long to, ll::level maxLev){
+    std::vector<std::string> ret;
+    for(const record& r: all){
+        if(r.ns >= from && r.ns <= to && r.lev <= maxLev){
+            ret.push_back(r.text);
+        }
+    }
+    return ret;
+}
+
+std::string describe(long long from, long long to, ll::level maxLev, size_t got, size_t want){
+    return "[" + std::to_string(from) + ", " + std::to_string(to) + "] level " + std::to_string(maxLev) + ": " +
+           std::to_string(got) + " lines, expected " + std::to_string(want);
+}
+
+// Compare random queries of a reader with the scan of the file
+void compare(const std::string& path, const ll::llfmt& format, size_t chunkBytes, const char* what, std::mt19937& rng){
+    const std::vector<record> all = scan(path, format);
+    ll::LogReader reader(path, format, chunkBytes);
+    check(reader.good(), what, "not good");
+
+    long long lo = INT64_MAX;
+    long long hi = INT64_MIN;
+    for(const record& r: all){
+        lo = std::min(lo, r.ns);
+        hi = std::max(hi, r.ns);
+    }
+    for(int q = 0; q < 300; ++q){
+        long long from = INT64_MIN;
+        long long to = INT64_MAX;
+        if(q == 1 && !all.empty()){
+            // The first line alone
+            from = all.front().ns;
+            to = from;
+        }else if(q > 0 && !all.empty()){
+            // Bounds at times of lines and in between, narrow and wide
+            from = all[rng() % all.size()].ns - static_cast<long long>(rng() % 2);
+            to = q % 3 == 0 ? all[rng() % all.size()].ns : from + static_cast<long long>(rng() % (20 * second));
+            if(q % 5 == 0){
+                from = lo - second;
+                to = hi + second;
+            }
+        }
+        const ll::level maxLev = q == 1 ? ll::debug : static_cast<ll::level>(q % ll::levels);
+        std::vector<std::string> got;
+        const size_t count = reader.forEach(from, to, maxLev, [&got](const char* line, size_t len, long long, ll::level){
+            got.emplace_back(line, len);
+        });
+        const std::vector<std::string> want = expected(all, from, to, maxLev);
+        if(got != want || count != got.size()){
+            check(false, what, describe(from, to, maxLev, got.size(), want.size()));
+            return;
+        }
+    }
+}
+
+// Lines printed by llquery for a range given in whole seconds
+size_t llquery(const char* tool, const std::string& path, long long fromSec, long long toSec, const char* lev){
+    const std::string cmd = std::string(tool) + " -f @" + std::to_string(fromSec) + " -t @" + std::to_string(toSec) +
+                            " -l " + lev + " " + path;
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if(pipe == nullptr){
+        return SIZE_MAX;
+    }
+    size_t lines = 0;
+    char buf[1024];
+    while(std::fgets(buf, sizeof(buf), pipe) != nullptr){
+        lines += buf[std::strlen(buf) - 1] == '\n' ? 1 : 0;
+    }
+    return pclose(pipe) == 0 ? lines : SIZE_MAX;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    const std::string path = "/tmp/llLogReader." + std::to_string(getpid());
+    std::mt19937 rng(7);
+    ll::llfmt ansi(ll::llfmt::defaultLevelStr(), ll::manual);
+    ansi << "[" << ll::llfmt::timeMs << "] " << ll::llfmt::level << ": " << ll::llfmt::logStr;
+    ll::llfmt plainNames(ll::llfmt::plainLevelStr(), ll::manual);
+    plainNames << "[" << ll::llfmt::timeMs << "] " << ll::llfmt::level << ": " << ll::llfmt::logStr;
+    unlink(path.c_str());
+    unlink((path + ".lidx").c_str());
+
+    // Chunks of a few lines, and of many
+    writeLog(path, ansi, base, 3000, rng);
+    compare(path, ansi, 256, "new index", rng);
+    compare(path, ansi, 256, "index loaded", rng);
+    unlink((path + ".lidx").c_str());
+    compare(path, ansi, 1 << 16, "large chunks", rng);
+
+    // Lines appended since the index was written are indexed on opening
+    writeLog(path, ansi, base + 600 * second, 1000, rng);
+    compare(path, ansi, 256, "appended lines", rng);
+
+    // An index of other level names is rebuilt, then rebuilt back
+    compare(path, plainNames, 256, "other level names", rng);
+    compare(path, ansi, 256, "level names restored", rng);
+
+    // A file rewritten in place with another year on its first line, which
+    // only the start of the file kept by the index tells
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        // "[ 2023-"
+        file.seekp(5);
+        file.put('4');
+    }
+    compare(path, ansi, 256, "first line rewritten", rng);
+
+    // A file replaced by a longer one with other lines at its start
+    unlink(path.c_str());
+    writeLog(path, ansi, base + 86400 * second, 6000, rng);
+    compare(path, ansi, 256, "replaced file", rng);
+
+    if(argc > 1){
+        const std::vector<record> all = scan(path, ansi);
+        const long long from = base / second + 86400 + 2;
+        const long long to = from + 5;
+        const size_t want = expected(all, from * second, to * second, ll::warning).size();
+        const size_t got = llquery(argv[1], path, from, to, "warning");
+        check(want > 0 && got == want, "llquery lines", std::to_string(got) + ", expected " + std::to_string(want));
+    }
+
+    unlink(path.c_str());
+    unlink((path + ".lidx").c_str());
+    return failed;
+}
@@ -0,0 +1,158 @@
+// NativeSyslog against a datagram socket standing in for /dev/log: the
+// headers of both formats, lines held until the batch is sent, and the
+// reconnection once the daemon recreated its socket.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nativeSyslog.hpp"
+
+namespace{
+
+// Bind a datagram socket at path the way a syslog daemon does
+int bindDaemon(const std::string& path){
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return -1;
+    }
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    timeval timeout{1, 0};
+    if(bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+       setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Datagrams waiting on fd, reading up to max of them or until none came
+// for the receive timeout, or right away if wait is false
+std::vector<std::string> receive(int fd, size_t max, bool wait = true){
+    std::vector<std::string> ret;
+    char buf[4096];
+    while(ret.size() < max){
+        ssize_t len = recv(fd, buf, sizeof(buf), wait ? 0 : MSG_DONTWAIT);
+        if(len < 0 && errno == EINTR){
+            continue;
+        }
+        if(len < 0){
+            break;
+        }
+        ret.emplace_back(buf, static_cast<size_t>(len));
+    }
+    return ret;
+}
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+std::string priority(int facility, ll::level lev){
+    return "<" + std::to_string(facility | ll::Syslog::defaultSeverityMap()[lev]) + ">";
+}
+
+} // namespace
+
+int main(){
+    const std::string path = "/tmp/llNativeSyslog." + std::to_string(getpid());
+    const std::string pid = std::to_string(getpid());
+    int daemon = bindDaemon(path);
+    if(daemon < 0){
+        std::fprintf(stderr, "cannot bind %s: %s\n", path.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    {
+        ll::NativeSyslog sink("llTest", LOG_USER, ll::rfc3164, ll::flushPolicy(), ll::Syslog::defaultSeverityMap(), path);
+        sink.log("Weather control device detected.", ll::warning);
+        std::vector<std::string> got = receive(daemon, 1);
+        check(got.size() == 1, "rfc3164: no datagram received");
+        if(!got.empty()){
+            const std::regex header(priority(LOG_USER, ll::warning) + "[A-Z][a-z]{2} [ 0-9][0-9] [0-9]{2}:[0-9]{2}:[0-9]{2} "
+                                    "llTest\\[" + pid + "\\]: Weather control device detected\\.");
+            check(std::regex_match(got[0], header), "rfc3164: unexpected datagram", got[0]);
+        }
+    }
+
+    {
+        ll::NativeSyslog sink("llTest", LOG_LOCAL0, ll::rfc5424, ll::flushPolicy(), ll::Syslog::defaultSeverityMap(), path);
+        sink.log("Weather control device detected.", ll::error);
+        std::vector<std::string> got = receive(daemon, 1);
+        check(got.size() == 1, "rfc5424: no datagram received");
+        if(!got.empty()){
+            const std::regex header(priority(LOG_LOCAL0, ll::error) + "1 [0-9]{4}-[0-9]{2}-[0-9]{2}T"
+                                    "[0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{6}Z [^ ]+ llTest " + pid +
+                                    " - - Weather control device detected\\.");
+            check(std::regex_match(got[0], header), "rfc5424: unexpected datagram", got[0]);
+        }
+    }
+
+    {
+        // Lines below the immediate level wait for 1 MB or a flush, then
+        // go out as one datagram each, in order. They stay below the
+        // default queue length of Unix datagram sockets, as nothing reads
+        // until the flush returned.
+        ll::NativeSyslog sink("llTest", LOG_USER, ll::rfc3164, ll::flushPolicy(1 << 20),
+                              ll::Syslog::defaultSeverityMap(), path);
+        for(int i = 0; i < 8; ++i){
+            sink.log("line " + std::to_string(i), ll::info);
+        }
+        check(receive(daemon, 1, false).empty(), "batch: lines sent before the flush");
+        sink.flush();
+        std::vector<std::string> got = receive(daemon, 8);
+        check(got.size() == 8, "batch: lines missing after the flush", std::to_string(got.size()));
+        for(size_t i = 0; i < got.size(); ++i){
+            const std::string end = ": line " + std::to_string(i);
+            if(got[i].size() < end.size() || got[i].compare(got[i].size() - end.size(), end.size(), end) != 0){
+                check(false, "batch: line out of order", got[i]);
+                break;
+            }
+        }
+        check(sink.errors() == 0, "batch: send errors", std::to_string(sink.errors()));
+    }
+
+    {
+        ll::NativeSyslog sink("llTest", LOG_USER, ll::rfc3164, ll::flushPolicy(), ll::Syslog::defaultSeverityMap(), path);
+        sink.log("before the restart", ll::info);
+        check(receive(daemon, 1).size() == 1, "restart: no datagram before the restart");
+
+        // The daemon restarts: its socket is closed and bound again at the
+        // same path, which the sink has to connect to anew
+        close(daemon);
+        daemon = bindDaemon(path);
+        if(daemon < 0){
+            std::fprintf(stderr, "cannot bind %s again: %s\n", path.c_str(), std::strerror(errno));
+            unlink(path.c_str());
+            return 1;
+        }
+        sink.log("after the restart", ll::info);
+        std::vector<std::string> got = receive(daemon, 1);
+        check(got.size() == 1, "restart: no datagram after the restart");
+        if(!got.empty()){
+            check(got[0].find(": after the restart") != std::string::npos, "restart: unexpected datagram", got[0]);
+        }
+        check(sink.errors() == 0, "restart: send errors", std::to_string(sink.errors()));
+    }
+
+    close(daemon);
+    unlink(path.c_str());
+    return failed;
+}
@@ -0,0 +1,159 @@
+// Messages let through and suppressed counts reported by each predicate of
+// rateLimit.hpp, and the summary llogger appends to the messages passing.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llogger.h"
+#include "rateLimit.hpp"
+
+namespace{
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+struct tally{
+    unsigned long long passed = 0;
+    unsigned long long reported = 0;
+    // Suppressed count of each message passing, in order
+    std::vector<unsigned long long> counts;
+};
+
+template<typename P>
+tally run(P& predicate, unsigned long long calls){
+    tally ret;
+    for(unsigned long long i = 0; i < calls; ++i){
+        const ll::passed p = predicate();
+        if(p.pass){
+            ++ret.passed;
+            ret.reported += p.suppressed;
+            ret.counts.push_back(p.suppressed);
+        }else{
+            check(p.suppressed == 0, "suppressed count on a dropped message");
+        }
+    }
+    return ret;
+}
+
+std::string counts(const tally& t){
+    std::string ret = std::to_string(t.passed) + " passed:";
+    for(size_t i = 0; i < t.counts.size() && i < 8; ++i){
+        ret += ' ' + std::to_string(t.counts[i]);
+    }
+    return ret;
+}
+
+struct lineSink{
+    std::vector<std::string> lines;
+
+    void log(const std::string& str){
+        lines.push_back(str);
+    }
+};
+
+bool endsWith(const std::string& str, const std::string& end){
+    return str.size() >= end.size() && str.compare(str.size() - end.size(), end.size(), end) == 0;
+}
+
+} // namespace
+
+int main(){
+    {
+        ll::every_n pred(10);
+        const tally t = run(pred, 95);
+        bool ok = t.passed == 10 && t.counts[0] == 0;
+        for(size_t i = 1; i < t.counts.size(); ++i){
+            ok = ok && t.counts[i] == 9;
+        }
+        check(ok, "every_n(10) over 95 calls", counts(t));
+    }
+    {
+        ll::first_n pred(3, 5);
+        const tally t = run(pred, 23);
+        // 3 first, then the 5th, 10th, 15th and 20th of the other 20
+        const std::vector<unsigned long long> want = {0, 0, 0, 4, 4, 4, 4};
+        check(t.counts == want, "first_n(3, 5) over 23 calls", counts(t));
+        check(pred.suppressed() == 16, "first_n(3, 5) suppressed()", std::to_string(pred.suppressed()));
+    }
+    {
+        ll::first_n pred(3, 0);
+        const tally t = run(pred, 5000);
+        check(t.passed == 3 && t.reported == 0, "first_n(3, 0) over 5000 calls", counts(t));
+        check(pred.suppressed() == 4997, "first_n(3, 0) suppressed()", std::to_string(pred.suppressed()));
+    }
+    {
+        // The default lets a summary through after the first n
+        ll::first_n pred(3);
+        const unsigned long long every = ll::first_n::defaultEvery;
+        const tally t = run(pred, 3 + 2 * every);
+        const std::vector<unsigned long long> want = {0, 0, 0, every - 1, every - 1};
+        check(t.counts == want, "first_n(3) over 2003 calls", counts(t));
+    }
+    {
+        ll::per_second pred(5);
+        // Use up the budget of the current second, dropping one message
+        const ll::passed first = pred();
+        unsigned long long burst = 1;
+        while(pred().pass){
+            ++burst;
+        }
+        // Unless a second began meanwhile
+        check(burst == 5 || burst == 10, "per_second(5) burst", std::to_string(burst));
+        tally t = run(pred, 100);
+        check(t.passed == 0, "per_second(5) past its budget", counts(t));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        t = run(pred, 100);
+        check(first.pass && first.suppressed == 0, "per_second(5) first message");
+        // The first of the next window reports the 101 dropped since
+        check(t.passed == 5 && t.counts[0] == 101, "per_second(5) in the next second", counts(t));
+        for(size_t i = 1; i < t.counts.size(); ++i){
+            check(t.counts[i] == 0, "per_second(5) reported twice", counts(t));
+        }
+        ll::per_second none(0);
+        check(run(none, 100).passed == 0, "per_second(0)");
+    }
+    {
+        ll::sample never(0);
+        check(run(never, 1000).passed == 0, "sample(0)");
+        ll::sample always(1);
+        const tally t = run(always, 1000);
+        check(t.passed == 1000 && t.reported == 0, "sample(1)", counts(t));
+        ll::sample tenth(0.1);
+        const unsigned long long calls = 100000;
+        const tally s = run(tenth, calls);
+        check(s.passed > 9000 && s.passed < 11000, "sample(0.1) over 100000 calls", counts(s));
+        // Each dropped message is reported once, except those after the last
+        // one passing
+        const ll::passed last = tenth();
+        const unsigned long long total = s.reported + (last.pass ? last.suppressed : 0);
+        check(total <= calls - s.passed && total + 200 >= calls - s.passed, "sample(0.1) reported",
+              std::to_string(total));
+    }
+    {
+        lineSink sink;
+        ll::llogger<lineSink> logger(ll::debug, sink);
+        static ll::every_n storm(3);
+        for(int i = 0; i < 7; ++i){
+            logger(ll::info, storm()) << "storm " << i;
+        }
+        check(sink.lines.size() == 3, "lines logged through every_n(3)", std::to_string(sink.lines.size()));
+        if(sink.lines.size() == 3){
+            check(endsWith(sink.lines[0], "storm 0\n") || endsWith(sink.lines[0], "storm 0"), "first line",
+                  sink.lines[0]);
+            check(sink.lines[1].find("storm 3 [2 messages suppressed]") != std::string::npos, "summary",
+                  sink.lines[1]);
+            check(sink.lines[2].find("storm 6 [2 messages suppressed]") != std::string::npos, "summary",
+                  sink.lines[2]);
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,98 @@
+// Lines written by several threads through a UringSink with small buffers,
+// some longer than a buffer, read back whole and in order. Threads exit
+// while their writes may still be in flight. Built a second time with
+// LL_NO_IO_URING to cover the pwritev fallback.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "uringSink.hpp"
+
+namespace{
+
+int failed = 0;
+
+void check(bool ok, const char* what, const std::string& got = std::string()){
+    if(!ok){
+        std::fprintf(stderr, "%s%s%s\n", what, got.empty() ? "" : ": ", got.c_str());
+        failed = 1;
+    }
+}
+
+const int threads = 4;
+const int perThread = 5000;
+const size_t bufferBytes = 512;
+
+std::string threadLine(int t, int i){
+    std::string ret = "thread " + std::to_string(t) + " line " + std::to_string(i);
+    // Some lines need a buffer of their own
+    if(i % 97 == 0){
+        ret += ' ' + std::string(bufferBytes * 2, static_cast<char>('a' + t));
+    }else{
+        ret += ' ' + std::string(static_cast<size_t>(i % 40), '.');
+    }
+    return ret;
+}
+
+} // namespace
+
+int main(){
+    const std::string path = "/tmp/llUringSink." + std::to_string(getpid());
+    unlink(path.c_str());
+    {
+        ll::UringSink sink(path, ll::flushPolicy(bufferBytes, std::chrono::milliseconds(2), ll::error),
+                           std::chrono::milliseconds(5), 2);
+#ifdef LL_NO_IO_URING
+        check(!sink.usesUring(), "io_uring used while disabled");
+#else
+        if(!sink.usesUring()){
+            std::fprintf(stderr, "io_uring refused, writing through pwritev\n");
+        }
+#endif
+        std::vector<std::thread> ts;
+        for(int t = 0; t < threads; ++t){
+            ts.emplace_back([&sink, t]{
+                for(int i = 0; i < perThread; ++i){
+                    sink.log(threadLine(t, i), i % 500 == 0 ? ll::error : ll::info);
+                }
+            });
+        }
+        for(int i = 0; i < 20; ++i){
+            sink.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for(std::thread& t: ts){
+            t.join();
+        }
+        check(sink.errors() == 0, "errors while writing", std::to_string(sink.errors()));
+    }
+
+    // Every line once, and each thread's in the order it logged them
+    std::ifstream in(path);
+    std::string line;
+    std::vector<int> next(threads, 0);
+    size_t lines = 0;
+    while(std::getline(in, line)){
+        ++lines;
+        int t = -1;
+        int i = -1;
+        if(std::sscanf(line.c_str(), "thread %d line %d", &t, &i) != 2 || t < 0 || t >= threads ||
+           line != threadLine(t, i)){
+            check(false, "unexpected line", line.substr(0, 64));
+            break;
+        }
+        if(i != next[t]++){
+            check(false, "line out of order", line.substr(0, 64));
+            break;
+        }
+    }
+    check(lines == static_cast<size_t>(threads * perThread), "lines written", std::to_string(lines));
+
+    unlink(path.c_str());
+    return failed;
+}
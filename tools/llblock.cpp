@@ -0,0 +1,97 @@
+// Print the lines of a block-compressed file written by ll::BlockSink.
+//   llblock [-i] [-f from] [-t to] <file>
+// -f and -t restrict the output to the blocks overlapping a time range,
+// given as local time yyyy-mm-ddThh:mm:ss or as @seconds since epoch.
+// -i lists the blocks of the index instead of printing lines.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "blockSink.hpp"
+
+namespace{
+
+// end makes a time given to the second stand for the last ns of it
+bool parseTime(const char* text, long long& ns, bool end){
+    if(text[0] == '@'){
+        char* rest;
+        const double sec = std::strtod(text + 1, &rest);
+        ns = static_cast<long long>(sec * 1e9);
+        return *rest == '\0' && rest != text + 1;
+    }
+
+    std::tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    const char* rest = strptime(text, "%Y-%m-%dT%H:%M:%S", &tm);
+    if(rest == nullptr || *rest != '\0'){
+        return false;
+    }
+    tm.tm_isdst = -1;
+    ns = static_cast<long long>(std::mktime(&tm)) * 1000000000LL + (end ? 999999999LL : 0);
+    return true;
+}
+
+std::string formatNs(long long ns){
+    std::time_t sec = static_cast<std::time_t>(ns / 1000000000LL);
+    std::tm tm;
+    localtime_r(&sec, &tm);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+    return text;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    bool index = false;
+    long long from = INT64_MIN;
+    long long to = INT64_MAX;
+    const char* path = nullptr;
+    bool ok = true;
+    for(int i = 1; i < argc && ok; ++i){
+        if(std::strcmp(argv[i], "-i") == 0){
+            index = true;
+        }else if(std::strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+            ok = parseTime(argv[++i], from, false);
+        }else if(std::strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+            ok = parseTime(argv[++i], to, true);
+        }else{
+            path = argv[i];
+        }
+    }
+    if(!ok || path == nullptr){
+        std::fprintf(stderr, "usage: %s [-i] [-f yyyy-mm-ddThh:mm:ss|@sec] [-t yyyy-mm-ddThh:mm:ss|@sec] <file>\n", argv[0]);
+        return 2;
+    }
+
+    ll::BlockReader reader(path);
+    if(!reader.good()){
+        std::fprintf(stderr, "%s: cannot open\n", path);
+        return 1;
+    }
+
+    if(index){
+        for(const ll::blockInfo& info: reader.blocks()){
+            if(info.lastNs < from || info.firstNs > to){
+                continue;
+            }
+            std::printf("%s %s offset %llu raw %u compressed %u\n",
+                        formatNs(info.firstNs).c_str(), formatNs(info.lastNs).c_str(),
+                        static_cast<unsigned long long>(info.offset), info.rawLen, info.compLen);
+        }
+        return 0;
+    }
+
+    const size_t failed = reader.forEach(from, to, [](const char* line, size_t len){
+        std::fwrite(line, 1, len, stdout);
+        std::fputc('\n', stdout);
+    });
+    if(failed != 0){
+        std::fprintf(stderr, "%s: %zu damaged blocks skipped\n", path, failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+
+// Render a binary log written by ll::BinLog as llfmt text.
+//   lldecode [-p digits] [-s] <file>
+// -p prints 3, 6 or 9 sub-second digits in timestamps, -s sorts the
+// statements of all threads by time instead of keeping file order.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "binLog.hpp"
+#include "llogger.h"
+
+int main(int argc, char** argv){
+    int digits = 0;
+    bool sort = false;
+    const char* path = nullptr;
+    for(int i = 1; i < argc; ++i){
+        if(std::strcmp(argv[i], "-p") == 0 && i + 1 < argc){
+            digits = std::atoi(argv[++i]);
+        }else if(std::strcmp(argv[i], "-s") == 0){
+            sort = true;
+        }else{
+            path = argv[i];
+        }
+    }
+    if(path == nullptr || (digits != 0 && digits != 3 && digits != 6 && digits != 9)){
+        std::fprintf(stderr, "usage: %s [-p 3|6|9] [-s] <file>\n", argv[0]);
+        return 2;
+    }
+
+    ll::BinDecoder decoder(path);
+    if(!decoder.good()){
+        std::fprintf(stderr, "%s: not a binary log\n", path);
+        return 1;
+    }
+
+    // The default llfmt format, stamped with the recorded time
+    const ll::llfmt::infoType time = digits == 0 ? ll::llfmt::time :
+                                     digits == 3 ? ll::llfmt::timeMs :
+                                     digits == 6 ? ll::llfmt::timeUs : ll::llfmt::timeNs;
+    ll::llfmt fmt(ll::llfmt::defaultLevelStr(), ll::manual);
+    fmt << "[" << time << "] " << ll::llfmt::level << ": " << ll::llfmt::logStr;
+    ll::OStreamSync out(std::cout, ll::flushPolicy(1 << 16, std::chrono::milliseconds(0), ll::silent));
+    ll::llogger<> logger(ll::debug, out, fmt);
+
+    struct statement{
+        long long ns;
+        ll::level lev;
+        std::string text;
+    };
+    std::vector<statement> statements;
+
+    const bool ok = decoder.forEach([&](ll::level lev, long long ns, const std::string& text){
+        if(sort){
+            statements.push_back({ns, lev, text});
+        }else{
+            ll::setManualTime(ns);
+            logger(lev) << text;
+        }
+    });
+
+    std::stable_sort(statements.begin(), statements.end(), [](const statement& a, const statement& b){
+        return a.ns < b.ns;
+    });
+    for(const statement& st: statements){
+        ll::setManualTime(st.ns);
+        logger(st.lev) << st.text;
+    }
+
+    if(!ok){
+        out.flush();
+        std::fprintf(stderr, "%s: truncated or corrupt\n", path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Print the lines of a text log within a time range, using a sparse index
+// kept next to the file in <file>.lidx.
+//   llquery [-i] [-f from] [-t to] [-l level] <file>
+// -f and -t give the range as local time yyyy-mm-ddThh:mm:ss or as
+// @seconds since epoch, -l the least severe level printed. -i lists the
+// chunks of the index instead of printing lines. The file must use the
+// default layout "[ time ] LEVEL: message", with colored, plain or
+// lowercase level names and any sub-second precision, which is detected
+// from its first lines.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llogger.h"
+#include "logReader.hpp"
+
+namespace{
+
+// end makes a time given to the second stand for the last ns of it
+bool parseTime(const char* text, long long& ns, bool end){
+    if(text[0] == '@'){
+        char* rest;
+        const double sec = std::strtod(text + 1, &rest);
+        ns = static_cast<long long>(sec * 1e9);
+        return *rest == '\0' && rest != text + 1;
+    }
+
+    std::tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    const char* rest = strptime(text, "%Y-%m-%dT%H:%M:%S", &tm);
+    if(rest == nullptr || *rest != '\0'){
+        return false;
+    }
+    tm.tm_isdst = -1;
+    ns = static_cast<long long>(std::mktime(&tm)) * 1000000000LL + (end ? 999999999LL : 0);
+    return true;
+}
+
+bool parseLevel(const char* text, ll::level& lev){
+    for(size_t i = 0; i < ll::levels; ++i){
+        if(std::strcmp(text, ll::llfmt::lowerLevelStr()[i]) == 0){
+            lev = static_cast<ll::level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string formatNs(long long ns){
+    std::time_t sec = static_cast<std::time_t>(ns / 1000000000LL);
+    std::tm tm;
+    localtime_r(&sec, &tm);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+    return text;
+}
+
+// The default layout with the level names and time precision that parse
+// the most of the first lines of the file
+std::unique_ptr<ll::llfmt> detectFormat(const char* path){
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    std::string line;
+    while(lines.size() < 64 && std::getline(in, line)){
+        lines.push_back(line);
+    }
+
+    const ll::llfmt::levelStrArr* names[] = {
+        &ll::llfmt::defaultLevelStr(), &ll::llfmt::plainLevelStr(), &ll::llfmt::lowerLevelStr()
+    };
+    const ll::llfmt::infoType times[] = {
+        ll::llfmt::time, ll::llfmt::timeMs, ll::llfmt::timeUs, ll::llfmt::timeNs
+    };
+    std::unique_ptr<ll::llfmt> ret;
+    size_t best = 0;
+    for(const ll::llfmt::levelStrArr* levelNames: names){
+        for(ll::llfmt::infoType time: times){
+            std::unique_ptr<ll::llfmt> format(new ll::llfmt(*levelNames));
+            *format << "[" << time << "] " << ll::llfmt::level << ": " << ll::llfmt::logStr;
+
+            ll::lineParser parser(*format);
+            size_t parsed = 0;
+            long long ns = 0;
+            ll::level lev = ll::info;
+            for(const std::string& l: lines){
+                parsed += parser.parse(l.data(), l.size(), ns, lev) ? 1 : 0;
+            }
+            if(parsed > best || ret == nullptr){
+                best = parsed;
+                ret = std::move(format);
+            }
+        }
+    }
+    return ret;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    bool index = false;
+    long long from = INT64_MIN;
+    long long to = INT64_MAX;
+    ll::level lev = ll::debug;
+    const char* path = nullptr;
+    bool ok = true;
+    for(int i = 1; i < argc && ok; ++i){
+        if(std::strcmp(argv[i], "-i") == 0){
+            index = true;
+        }else if(std::strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+            ok = parseTime(argv[++i], from, false);
+        }else if(std::strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+            ok = parseTime(argv[++i], to, true);
+        }else if(std::strcmp(argv[i], "-l") == 0 && i + 1 < argc){
+            ok = parseLevel(argv[++i], lev);
+        }else{
+            path = argv[i];
+        }
+    }
+    if(!ok || path == nullptr){
+        std::fprintf(stderr, "usage: %s [-i] [-f yyyy-mm-ddThh:mm:ss|@sec] [-t yyyy-mm-ddThh:mm:ss|@sec] "
+                             "[-l fatal|error|warning|notice|info|debug] <file>\n", argv[0]);
+        return 2;
+    }
+
+    std::unique_ptr<ll::llfmt> format = detectFormat(path);
+    ll::LogReader reader(path, *format);
+    if(!reader.good()){
+        std::fprintf(stderr, "%s: cannot open\n", path);
+        return 1;
+    }
+
+    if(index){
+        for(const ll::lineChunk& chunk: reader.chunks()){
+            if(chunk.maxNs < from || chunk.minNs > to){
+                continue;
+            }
+            std::printf("%s %s offset %llu\n", formatNs(chunk.minNs).c_str(), formatNs(chunk.maxNs).c_str(),
+                        static_cast<unsigned long long>(chunk.offset));
+        }
+        return 0;
+    }
+
+    reader.forEach(from, to, lev, [](const char* line, size_t len, long long, ll::level){
+        std::fwrite(line, 1, len, stdout);
+        std::fputc('\n', stdout);
+    });
+    return 0;
+}
@@ -0,0 +1,48 @@
+
+// Print the lines held by a ring file written by ll::MmapRing, oldest first.
+//   llring [-s] <file>
+// -s also reports the capacity, cursor and wrap count of the ring on stderr.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "mmapRing.hpp"
+
+int main(int argc, char** argv){
+    bool summary = false;
+    const char* path = nullptr;
+    for(int i = 1; i < argc; ++i){
+        if(std::strcmp(argv[i], "-s") == 0){
+            summary = true;
+        }else{
+            path = argv[i];
+        }
+    }
+    if(path == nullptr){
+        std::fprintf(stderr, "usage: %s [-s] <file>\n", argv[0]);
+        return 2;
+    }
+
+    ll::MmapRingReader reader(path);
+    if(!reader.good()){
+        std::fprintf(stderr, "%s: not a ring file\n", path);
+        return 1;
+    }
+
+    unsigned long long count = 0;
+    unsigned long long skipped = reader.forEach([&count](ll::level, const std::string& text){
+        std::fwrite(text.data(), 1, text.size(), stdout);
+        std::fputc('\n', stdout);
+        ++count;
+    });
+
+    if(summary){
+        std::fprintf(stderr, "capacity %llu, cursor %llu, wraps %llu, records %llu, skipped %llu bytes\n",
+                     static_cast<unsigned long long>(reader.capacity()),
+                     static_cast<unsigned long long>(reader.cursor()),
+                     static_cast<unsigned long long>(reader.wraps()),
+                     count, skipped);
+    }
+    return 0;
+}